@@ -0,0 +1,96 @@
+// Single-pass assembler. The source is scanned once as a string_view: lines are found
+// with memchr, tokens are sub-views of the source, and opcodes/registers are looked up
+// by switching on token length, so nothing is allocated per line.
+//
+// It accepts exactly what the original istringstream assembler accepted: one
+// instruction per line, whitespace-separated "OPCODE reg1 reg2", extra tokens ignored,
+// and unknown or missing fields encoded as 0.
+#ifndef VCPU_ASSEMBLER_H
+#define VCPU_ASSEMBLER_H
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "Machine.h"
+
+inline bool isAssemblerSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f' || c == '\n';
+}
+
+inline int opcodeValue(std::string_view token) {
+    switch (token.size()) {
+        case 3:
+            if (token == "ADD") return ADD;
+            if (token == "SUB") return SUB;
+            if (token == "RET") return RET;
+            break;
+        case 4:
+            if (token == "LOAD") return LOAD;
+            if (token == "JUMP") return JUMP;
+            if (token == "CALL") return CALL;
+            break;
+        case 5:
+            if (token == "STORE") return STORE;
+            if (token == "INPUT") return INPUT;
+            break;
+        case 6:
+            if (token == "OUTPUT") return OUTPUT;
+            break;
+    }
+    return 0;
+}
+
+inline int registerValue(std::string_view token) {
+    if (token.size() == 2 && token[0] == 'R' && token[1] >= '0' && token[1] < '0' + NAMED_REGISTERS) {
+        return token[1] - '0';
+    }
+    return 0;
+}
+
+// Encodes one line (without its '\n')
+inline int encodeLine(const char* begin, const char* end) {
+    std::string_view tokens[3];
+    int count = 0;
+    const char* p = begin;
+    while (count < 3) {
+        while (p < end && isAssemblerSpace(*p)) ++p;
+        if (p == end) break;
+        const char* start = p;
+        while (p < end && !isAssemblerSpace(*p)) ++p;
+        tokens[count++] = std::string_view(start, p - start);
+    }
+    return (opcodeValue(tokens[0]) << OPCODE_SHIFT) | (registerValue(tokens[1]) << 3) | registerValue(tokens[2]);
+}
+
+// Calls visit(begin, end) for every line, splitting like getline: a final line
+// without '\n' counts, an empty remainder after the last '\n' does not
+template <class Visitor>
+void forEachLine(std::string_view source, Visitor visit) {
+    const char* p = source.data();
+    const char* end = p + source.size();
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (lineEnd == nullptr) lineEnd = end;
+        visit(p, lineEnd);
+        p = lineEnd + 1;
+    }
+}
+
+inline size_t countLines(std::string_view source) {
+    if (source.empty()) return 0;
+    size_t newlines = std::count(source.begin(), source.end(), '\n');
+    return source.back() == '\n' ? newlines : newlines + 1;
+}
+
+inline std::vector<int> assemble(std::string_view assemblyCode) {
+    std::vector<int> machineCode;
+    machineCode.reserve(countLines(assemblyCode));
+    forEachLine(assemblyCode, [&](const char* begin, const char* end) {
+        machineCode.push_back(encodeLine(begin, end));
+    });
+    return machineCode;
+}
+
+#endif
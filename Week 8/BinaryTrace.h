@@ -0,0 +1,158 @@
+// Binary trace: a fixed header with the initial machine state, then one fixed-size
+// record per executed instruction. Records are buffered and streamed to disk while the
+// program runs; trace-decoder turns them back into the text traces offline.
+//
+// Layout (host byte order):
+//   BinaryTraceHeader
+//   BinaryTraceCell x header.initialCellCount   (non-zero memory cells at start)
+//   BinaryTraceRecord x N                       (until end of file)
+#ifndef VCPU_BINARY_TRACE_H
+#define VCPU_BINARY_TRACE_H
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Machine.h"
+
+const char BINARY_TRACE_MAGIC[8] = {'V', 'C', 'P', 'U', 'T', 'R', 'C', '1'};
+
+struct BinaryTraceHeader {
+    char magic[8];
+    uint32_t recordSize;  // sizeof(BinaryTraceRecord), rejects traces from a different layout
+    uint32_t registerCount;
+    uint64_t memorySize;
+    uint64_t initialCellCount;
+    uint8_t registers[REGISTER_COUNT];
+};
+
+struct BinaryTraceCell {
+    uint64_t address;
+    uint8_t value;
+    uint8_t padding[7];
+};
+
+// What one instruction did. Each instruction writes at most one register and one memory cell.
+struct BinaryTraceRecord {
+    enum Flags : uint8_t { WROTE_REGISTER = 1, WROTE_MEMORY = 2 };
+
+    uint32_t programCounter;
+    uint32_t word;
+    uint64_t memoryAddress;
+    int32_t inputValue;  // INPUT's value as read, before truncation to a Word
+    uint8_t flags;
+    uint8_t reg;
+    uint8_t registerValue;
+    uint8_t memoryValue;
+};
+
+static_assert(sizeof(BinaryTraceRecord) == 24, "binary trace records are fixed-size");
+
+// Trace policy that fills one record per instruction and streams them through a fixed buffer
+class TraceBinary {
+public:
+    static const size_t BUFFER_RECORDS = 4096;
+
+    TraceBinary(const std::string& path, const Registers& registers, const Memory& memory)
+        : file(path, std::ios::binary | std::ios::trunc), buffer(BUFFER_RECORDS), buffered(0) {
+        std::vector<BinaryTraceCell> cells;
+        memory.forEachNonZero([&](size_t address, Word value) {
+            BinaryTraceCell cell = {};
+            cell.address = address;
+            cell.value = value;
+            cells.push_back(cell);
+        });
+        BinaryTraceHeader header = {};
+        memcpy(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic));
+        header.recordSize = sizeof(BinaryTraceRecord);
+        header.registerCount = REGISTER_COUNT;
+        header.memorySize = memory.size();
+        header.initialCellCount = cells.size();
+        for (int i = 0; i < REGISTER_COUNT; ++i) {
+            header.registers[i] = registers.regs[i];
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(cells.data()), cells.size() * sizeof(BinaryTraceCell));
+    }
+    ~TraceBinary() { flush(); }
+
+    bool isOpen() const { return file.good(); }
+
+    void fetch(int address, const DecodedInstruction& instruction) {
+        current = BinaryTraceRecord();
+        current.programCounter = address;
+        current.word = instruction.word;
+    }
+    void decode(const DecodedInstruction&, Word, Word) {}
+    void input(int reg, int value) {
+        current.inputValue = value;
+        registerWrite(reg, static_cast<Word>(value));
+    }
+    void output(int, int) {}
+    void jump(Word) {}
+    void call(Word) {}
+    void ret(int) {}
+    void load(int reg, Word value) { registerWrite(reg, value); }
+    void store(Word, Word) {}
+    void alu(const DecodedInstruction& instruction, Word result) { registerWrite(instruction.reg1, result); }
+    void memoryWrite(size_t address, Word value) {
+        current.flags |= BinaryTraceRecord::WROTE_MEMORY;
+        current.memoryAddress = address;
+        current.memoryValue = value;
+    }
+    void retire(const Registers&, const Memory&) {
+        buffer[buffered++] = current;
+        if (buffered == BUFFER_RECORDS) {
+            flush();
+        }
+    }
+    void halt(int) { flush(); }
+
+private:
+    void registerWrite(int reg, Word value) {
+        current.flags |= BinaryTraceRecord::WROTE_REGISTER;
+        current.reg = reg;
+        current.registerValue = value;
+    }
+    void flush() {
+        file.write(reinterpret_cast<const char*>(buffer.data()), buffered * sizeof(BinaryTraceRecord));
+        file.flush();
+        buffered = 0;
+    }
+
+    std::ofstream file;
+    std::vector<BinaryTraceRecord> buffer;
+    size_t buffered;
+    BinaryTraceRecord current = {};
+};
+
+// Replays one record through a text trace policy, then applies its writes to the state
+template <class Trace>
+void renderBinaryTraceRecord(Trace& trace, const BinaryTraceRecord& record, Registers& registers, Memory& memory) {
+    DecodedInstruction instruction = decodeInstruction(record.word);
+    int reg1 = instruction.reg1;
+    Word operand1 = registers.get(reg1);
+    Word operand2 = registers.get(instruction.reg2);
+    trace.fetch(record.programCounter, instruction);
+    trace.decode(instruction, operand1, operand2);
+    switch (instruction.type) {
+        case INPUT: trace.input(reg1, record.inputValue); break;
+        case OUTPUT: trace.output(reg1, operand1); break;
+        case JUMP: trace.jump(operand2); break;
+        case CALL: trace.call(operand2); break;
+        case RET: trace.ret(memory.read(memory.size() - 1)); break;
+        case LOAD: trace.load(reg1, record.registerValue); break;
+        case STORE: trace.store(operand1, operand2); break;
+        default: trace.alu(instruction, record.registerValue); break;
+    }
+    if (record.flags & BinaryTraceRecord::WROTE_REGISTER) {
+        registers.set(record.reg, record.registerValue);
+    }
+    if (record.flags & BinaryTraceRecord::WROTE_MEMORY) {
+        memory.write(record.memoryAddress, record.memoryValue);
+    }
+    trace.retire(registers, memory);
+}
+
+#endif
@@ -0,0 +1,178 @@
+// Branch predictor models for JUMP/CALL/RET. Every transfer in this ISA is taken and
+// goes to a register or memory value, so the models predict the target address:
+//   static   always predicts the next sequential address (no prediction hardware)
+//   bimodal  a target buffer indexed by PC, with a 2-bit counter so one odd target
+//            does not replace a target that is usually right
+//   gshare   the same buffer indexed by PC xor a history of recent targets, which can
+//            tell apart the visits of a JUMP that cycles through several targets
+//   ras      bimodal for JUMP/CALL, plus a return-address stack for RET
+// A BranchModel runs several predictors side by side over the same transfers and counts
+// mispredictions per predictor and per instruction.
+#ifndef VCPU_BRANCH_PREDICTOR_H
+#define VCPU_BRANCH_PREDICTOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#include "Machine.h"
+
+enum PredictorKind { PREDICT_STATIC, PREDICT_BIMODAL, PREDICT_GSHARE, PREDICT_RAS, PREDICTOR_KINDS };
+
+inline const char* predictorName(PredictorKind kind) {
+    switch (kind) {
+        case PREDICT_BIMODAL: return "bimodal";
+        case PREDICT_GSHARE: return "gshare";
+        case PREDICT_RAS: return "ras";
+        default: return "static";
+    }
+}
+
+class BranchPredictor {
+public:
+    static const int TABLE_BITS = 10;
+    static const int RAS_DEPTH = 16;
+
+    explicit BranchPredictor(PredictorKind kind) : kind(kind), table(size_t(1) << TABLE_BITS) {}
+
+    int predict(int pc, InstructionType type) const {
+        if (kind == PREDICT_STATIC) {
+            return pc + 1;
+        }
+        if (kind == PREDICT_RAS && type == RET) {
+            return stackDepth == 0 ? pc + 1 : stack[(stackDepth - 1) % RAS_DEPTH];
+        }
+        const Entry& entry = table[index(pc)];
+        return entry.valid ? entry.target : pc + 1;
+    }
+
+    void update(int pc, InstructionType type, int target) {
+        if (kind == PREDICT_STATIC) {
+            return;
+        }
+        if (kind == PREDICT_RAS && (type == CALL || type == RET)) {
+            if (type == CALL) {
+                // Pushes what CALL stores: the return address truncated to a Word
+                stack[stackDepth++ % RAS_DEPTH] = static_cast<Word>(pc + 1);
+            } else {
+                if (stackDepth > 0) --stackDepth;
+                return;
+            }
+        }
+        Entry& entry = table[index(pc)];
+        if (entry.valid && entry.target == target) {
+            entry.confidence = std::min(entry.confidence + 1, 3);
+        } else if (entry.valid && entry.confidence > 0) {
+            --entry.confidence;
+        } else {
+            entry = {target, 1, true};
+        }
+        if (kind == PREDICT_GSHARE) {
+            history = ((history << 3) ^ static_cast<uint32_t>(target)) & (table.size() - 1);
+        }
+    }
+
+    PredictorKind predictorKind() const { return kind; }
+
+private:
+    struct Entry {
+        int target = 0;
+        int confidence = 0;
+        bool valid = false;
+    };
+
+    size_t index(int pc) const {
+        uint32_t key = static_cast<uint32_t>(pc);
+        if (kind == PREDICT_GSHARE) key ^= history;
+        return key & (table.size() - 1);
+    }
+
+    PredictorKind kind;
+    std::vector<Entry> table;
+    uint32_t history = 0;
+    int stack[RAS_DEPTH] = {};
+    int stackDepth = 0;
+};
+
+class BranchModel {
+public:
+    BranchModel(const std::vector<PredictorKind>& kinds, size_t programSize, int mispredictPenalty)
+        : penalty(mispredictPenalty), sites(programSize), siteMisses(programSize * kinds.size()) {
+        for (PredictorKind kind : kinds) {
+            predictors.emplace_back(kind);
+        }
+        totals.resize(kinds.size());
+    }
+
+    void transfer(int pc, InstructionType type, int target) {
+        bool inProgram = static_cast<size_t>(pc) < sites.size();
+        if (inProgram) ++sites[pc];
+        for (size_t i = 0; i < predictors.size(); ++i) {
+            bool miss = predictors[i].predict(pc, type) != target;
+            predictors[i].update(pc, type, target);
+            Totals& total = totals[i];
+            ++total.transfers[type - JUMP];
+            total.misses[type - JUMP] += miss;
+            if (miss && inProgram) ++siteMisses[pc * predictors.size() + i];
+        }
+    }
+
+    // Mispredictions per predictor and transfer kind, then the instructions the last
+    // predictor mispredicts most often
+    void report(std::ostream& out, const std::vector<DecodedInstruction>& program, size_t topSites = 10) const {
+        out << "Branch predictors (" << penalty << " cycle misprediction penalty):" << std::endl;
+        for (size_t i = 0; i < predictors.size(); ++i) {
+            const Totals& total = totals[i];
+            uint64_t transfers = total.transfers[0] + total.transfers[1] + total.transfers[2];
+            uint64_t misses = total.misses[0] + total.misses[1] + total.misses[2];
+            out << "  " << std::left << std::setw(8) << predictorName(predictors[i].predictorKind()) << std::right
+                << misses << " of " << transfers << " mispredicted (" << std::fixed << std::setprecision(2)
+                << percent(misses, transfers) << "%), " << misses * penalty << " penalty cycles; JUMP "
+                << percent(total.misses[0], total.transfers[0]) << "%, CALL " << percent(total.misses[1], total.transfers[1])
+                << "%, RET " << percent(total.misses[2], total.transfers[2]) << "%" << std::endl;
+            out.unsetf(std::ios::floatfield);
+        }
+
+        size_t ranked = predictors.size() - 1;
+        std::vector<size_t> order;
+        for (size_t pc = 0; pc < sites.size(); ++pc) {
+            if (sites[pc] > 0) order.push_back(pc);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return siteMisses[a * predictors.size() + ranked] > siteMisses[b * predictors.size() + ranked];
+        });
+        if (order.size() > topSites) order.resize(topSites);
+        if (order.empty()) return;
+        out << "  Mispredictions by instruction (most " << predictorName(predictors[ranked].predictorKind())
+            << " mispredictions first):" << std::endl;
+        for (size_t pc : order) {
+            const DecodedInstruction& instruction = program[pc];
+            out << "    " << pc << ": " << opcodeName(instruction.type) << " R" << static_cast<int>(instruction.reg1)
+                << " R" << static_cast<int>(instruction.reg2) << "  " << sites[pc] << " transfers";
+            for (size_t i = 0; i < predictors.size(); ++i) {
+                out << ", " << predictorName(predictors[i].predictorKind()) << ' ' << siteMisses[pc * predictors.size() + i];
+            }
+            out << std::endl;
+        }
+    }
+
+private:
+    struct Totals {
+        uint64_t transfers[3] = {};  // JUMP, CALL, RET
+        uint64_t misses[3] = {};
+    };
+
+    static double percent(uint64_t part, uint64_t whole) { return whole == 0 ? 0.0 : 100.0 * part / whole; }
+
+    int penalty;
+    std::vector<BranchPredictor> predictors;
+    std::vector<Totals> totals;
+    std::vector<uint64_t> sites;       // transfers executed at each address
+    std::vector<uint64_t> siteMisses;  // [address * predictors + predictor]
+};
+
+static_assert(CALL == JUMP + 1 && RET == JUMP + 2, "BranchModel indexes its totals by type - JUMP");
+
+#endif
@@ -0,0 +1,194 @@
+// Set-associative cache model for guest memory accesses. It tracks tags only: guest
+// memory stays the single source of data, and the model just classifies each access as
+// a hit or a miss at every level.
+//
+// Each level has a size, a line size and an associativity (all powers of two) and a
+// replacement policy. Levels are write-back and write-allocate. An access goes to L1,
+// and a miss goes on to the next level as a read that fetches the line: only L1 sees
+// the write itself. A dirty line evicted from one level is counted as a writeback and
+// written to the next level.
+#ifndef VCPU_CACHE_MODEL_H
+#define VCPU_CACHE_MODEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#include "Machine.h"
+
+enum ReplacementPolicy { REPLACE_LRU, REPLACE_FIFO, REPLACE_RANDOM };
+
+inline const char* replacementName(ReplacementPolicy policy) {
+    switch (policy) {
+        case REPLACE_FIFO: return "fifo";
+        case REPLACE_RANDOM: return "random";
+        default: return "lru";
+    }
+}
+
+struct CacheConfig {
+    size_t size = 64;      // bytes (cells)
+    size_t lineSize = 8;
+    size_t ways = 2;
+    ReplacementPolicy policy = REPLACE_LRU;
+};
+
+struct CacheStats {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t readMisses = 0;
+    uint64_t writeMisses = 0;
+    uint64_t writebacks = 0;
+
+    uint64_t accesses() const { return reads + writes; }
+    uint64_t misses() const { return readMisses + writeMisses; }
+};
+
+class CacheLevel {
+public:
+    explicit CacheLevel(const CacheConfig& config)
+        : config(config), sets(std::max<size_t>(1, config.size / (config.lineSize * config.ways))),
+          lineShift(0), lines(sets * config.ways) {
+        while ((size_t(1) << lineShift) < config.lineSize) ++lineShift;
+    }
+
+    // Returns true on a hit. On a miss the line is allocated; evictedDirty is set when
+    // that pushed out a dirty line, whose address is left in evicted.
+    bool access(uint64_t address, bool write, bool& evictedDirty, uint64_t& evicted) {
+        uint64_t tag = address >> lineShift;
+        Line* set = &lines[(tag & (sets - 1)) * config.ways];
+        ++clock;
+        (write ? stats.writes : stats.reads)++;
+        evictedDirty = false;
+        for (size_t way = 0; way < config.ways; ++way) {
+            if (set[way].valid && set[way].tag == tag) {
+                if (config.policy == REPLACE_LRU) set[way].stamp = clock;
+                set[way].dirty |= write;
+                return true;
+            }
+        }
+        (write ? stats.writeMisses : stats.readMisses)++;
+        Line& victim = set[chooseVictim(set)];
+        if (victim.valid && victim.dirty) {
+            ++stats.writebacks;
+            evictedDirty = true;
+            evicted = victim.tag << lineShift;
+        }
+        victim = {tag, clock, true, write};
+        return false;
+    }
+
+    const CacheConfig& configuration() const { return config; }
+    const CacheStats& statistics() const { return stats; }
+
+private:
+    struct Line {
+        uint64_t tag = 0;
+        uint64_t stamp = 0;  // last use (LRU) or fill (FIFO)
+        bool valid = false;
+        bool dirty = false;
+    };
+
+    size_t chooseVictim(const Line* set) {
+        for (size_t way = 0; way < config.ways; ++way) {
+            if (!set[way].valid) return way;
+        }
+        if (config.policy == REPLACE_RANDOM) {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            return random & (config.ways - 1);
+        }
+        size_t oldest = 0;
+        for (size_t way = 1; way < config.ways; ++way) {
+            if (set[way].stamp < set[oldest].stamp) oldest = way;
+        }
+        return oldest;
+    }
+
+    CacheConfig config;
+    size_t sets;
+    int lineShift;
+    std::vector<Line> lines;
+    uint64_t clock = 0;
+    uint64_t random = 88172645463325252ULL;
+    CacheStats stats;
+};
+
+// L1 and optional further levels, with miss counts per instruction address
+class CacheHierarchy {
+public:
+    CacheHierarchy(const std::vector<CacheConfig>& configs, size_t programSize) : sites(programSize) {
+        for (const CacheConfig& config : configs) {
+            levels.emplace_back(config);
+        }
+    }
+
+    void access(int pc, uint64_t address, bool write) {
+        Site* site = static_cast<size_t>(pc) < sites.size() ? &sites[pc] : nullptr;
+        if (site != nullptr) ++site->accesses;
+        for (size_t level = 0; level < levels.size(); ++level) {
+            bool evictedDirty;
+            uint64_t evicted;
+            // A write miss allocates in L1, which fetches the line from below
+            bool hit = levels[level].access(address, write && level == 0, evictedDirty, evicted);
+            if (evictedDirty && level + 1 < levels.size()) {
+                bool unusedDirty;
+                uint64_t unused;
+                levels[level + 1].access(evicted, true, unusedDirty, unused);
+            }
+            if (hit) return;
+            if (site != nullptr && level < MAX_REPORTED_LEVELS) ++site->misses[level];
+        }
+    }
+
+    // Hit/miss table per level, then the instructions with the most L1 misses
+    void report(std::ostream& out, const std::vector<DecodedInstruction>& program, size_t topSites = 10) const {
+        out << "Cache model:" << std::endl;
+        for (size_t level = 0; level < levels.size(); ++level) {
+            const CacheConfig& config = levels[level].configuration();
+            const CacheStats& stats = levels[level].statistics();
+            out << "  L" << level + 1 << " (" << config.size << " B, " << config.lineSize << " B lines, " << config.ways
+                << "-way, " << replacementName(config.policy) << "): " << stats.accesses() << " accesses, "
+                << stats.misses() << " misses (" << std::fixed << std::setprecision(2)
+                << percent(stats.misses(), stats.accesses()) << "%), " << stats.readMisses << " read / "
+                << stats.writeMisses << " write misses, " << stats.writebacks << " writebacks" << std::endl;
+            out.unsetf(std::ios::floatfield);
+        }
+
+        std::vector<size_t> order;
+        for (size_t pc = 0; pc < sites.size(); ++pc) {
+            if (sites[pc].accesses > 0) order.push_back(pc);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sites[a].misses[0] > sites[b].misses[0]; });
+        if (order.size() > topSites) order.resize(topSites);
+        if (order.empty()) return;
+        out << "  Accesses by instruction (most L1 misses first):" << std::endl;
+        for (size_t pc : order) {
+            const Site& site = sites[pc];
+            const DecodedInstruction& instruction = program[pc];
+            out << "    " << pc << ": " << opcodeName(instruction.type) << " R" << static_cast<int>(instruction.reg1)
+                << " R" << static_cast<int>(instruction.reg2) << "  " << site.accesses << " accesses";
+            for (size_t level = 0; level < std::min(levels.size(), MAX_REPORTED_LEVELS); ++level) {
+                out << ", L" << level + 1 << " misses " << site.misses[level];
+            }
+            out << std::endl;
+        }
+    }
+
+private:
+    static const size_t MAX_REPORTED_LEVELS = 3;
+    struct Site {
+        uint64_t accesses = 0;
+        uint64_t misses[MAX_REPORTED_LEVELS] = {};
+    };
+
+    static double percent(uint64_t part, uint64_t whole) { return whole == 0 ? 0.0 : 100.0 * part / whole; }
+
+    std::vector<CacheLevel> levels;
+    std::vector<Site> sites;
+};
+
+#endif
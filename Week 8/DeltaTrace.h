@@ -0,0 +1,214 @@
+// Delta trace: the initial machine state followed by one line per instruction that
+// lists only the registers and memory cells the instruction wrote.
+//
+//   vCPU delta trace 1
+//   memory-size 25
+//   registers 0 4 9 10 0 0 0 0
+//   init <address> <value>          (one per non-zero memory cell)
+//   steps
+//   <pc> <word>[ R<n>=<value>][ M<address>=<value>]
+//   halt <pc>
+//
+// Trace size is proportional to the number of writes, not instructions x memory size.
+#ifndef VCPU_DELTA_TRACE_H
+#define VCPU_DELTA_TRACE_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Machine.h"
+
+// Trace policy that writes the delta format above
+class TraceDelta {
+public:
+    TraceDelta(std::ostream& outputStream, const Registers& registers, const Memory& memory) : out(outputStream) {
+        out << "vCPU delta trace 1\n";
+        out << "memory-size " << memory.size() << '\n';
+        out << "registers";
+        for (int i = 0; i < REGISTER_COUNT; ++i) {
+            out << ' ' << static_cast<int>(registers.regs[i]);
+        }
+        out << '\n';
+        memory.forEachNonZero([&](size_t address, Word value) {
+            out << "init " << address << ' ' << static_cast<int>(value) << '\n';
+        });
+        out << "steps\n";
+    }
+    void fetch(int address, const DecodedInstruction& instruction) { out << address << ' ' << instruction.word; }
+    void decode(const DecodedInstruction&, Word, Word) {}
+    void input(int reg, int value) { registerWrite(reg, static_cast<Word>(value)); }
+    void output(int, int) {}
+    void jump(Word) {}
+    void call(Word) {}
+    void ret(int) {}
+    void load(int reg, Word value) { registerWrite(reg, value); }
+    void store(Word, Word) {}
+    void alu(const DecodedInstruction& instruction, Word result) { registerWrite(instruction.reg1, result); }
+    void memoryWrite(size_t address, Word value) { out << " M" << address << '=' << static_cast<int>(value); }
+    void retire(const Registers&, const Memory&) { out << '\n'; }
+    void halt(int programCounter) { out << "halt " << programCounter << '\n'; }
+
+private:
+    void registerWrite(int reg, Word value) { out << " R" << reg << '=' << static_cast<int>(value); }
+
+    std::ostream& out;
+};
+
+// One parsed instruction line of a delta trace
+struct DeltaStep {
+    int programCounter = 0;
+    int word = 0;
+    std::vector<std::pair<int, Word>> registerWrites;
+    std::vector<std::pair<size_t, Word>> memoryWrites;
+};
+
+// Reads a delta trace back: the header on construction, then one step at a time. A
+// malformed line stops the reader and leaves valid() false, naming the line.
+class DeltaTraceReader {
+public:
+    explicit DeltaTraceReader(std::istream& inputStream) : in(inputStream) {
+        std::string line;
+        if (!readLine(line) || line != "vCPU delta trace 1") {
+            error = "not a vCPU delta trace";
+            return;
+        }
+        while (readLine(line) && line != "steps") {
+            std::istringstream fields(line);
+            std::string key;
+            std::string field;
+            uint64_t value = 0;
+            fields >> key;
+            if (key == "memory-size") {
+                if (!(fields >> field) || !parseField(field, value) || value == 0 || value > MAX_MEMORY_SIZE) {
+                    badLine(line);
+                    return;
+                }
+                memorySize = static_cast<size_t>(value);
+            } else if (key == "registers") {
+                for (int i = 0; i < REGISTER_COUNT; ++i) {
+                    if (!(fields >> field) || !parseField(field, value) || value > 255) {
+                        badLine(line);
+                        return;
+                    }
+                    initialRegisters[i] = static_cast<Word>(value);
+                }
+            } else if (key == "init") {
+                uint64_t address = 0;
+                if (!(fields >> field) || !parseField(field, address) || address >= memorySize || !(fields >> field) ||
+                    !parseField(field, value) || value > 255) {
+                    badLine(line);
+                    return;
+                }
+                initialCells.push_back({static_cast<size_t>(address), static_cast<Word>(value)});
+            }
+        }
+        if (memorySize == 0) {
+            error = "delta trace has no memory-size header";
+        }
+    }
+
+    bool valid() const { return error.empty(); }
+    const std::string& errorMessage() const { return error; }
+    size_t memorySizeHeader() const { return memorySize; }
+    int haltAddress() const { return haltProgramCounter; }
+
+    void applyInitialState(Registers& registers, Memory& memory) const {
+        for (int i = 0; i < REGISTER_COUNT; ++i) {
+            registers.regs[i] = initialRegisters[i];
+        }
+        for (const auto& cell : initialCells) {
+            memory.write(cell.first, cell.second);
+        }
+    }
+
+    // Parses the next instruction line; returns false at "halt", at end of input or at a
+    // malformed line
+    bool next(DeltaStep& step) {
+        std::string line;
+        if (!valid() || !readLine(line)) {
+            return false;
+        }
+        uint64_t value = 0;
+        if (line.compare(0, 5, "halt ") == 0) {
+            if (!parseField(line.substr(5), value) || value > INT32_MAX) {
+                return badLine(line);
+            }
+            haltProgramCounter = static_cast<int>(value);
+            return false;
+        }
+        std::istringstream fields(line);
+        std::string field;
+        if (!(fields >> field) || !parseField(field, value) || value > INT32_MAX) {
+            return badLine(line);
+        }
+        step.programCounter = static_cast<int>(value);
+        if (!(fields >> field) || !parseField(field, value) || value > INT32_MAX) {
+            return badLine(line);
+        }
+        step.word = static_cast<int>(value);
+        step.registerWrites.clear();
+        step.memoryWrites.clear();
+        while (fields >> field) {
+            size_t equals = field.find('=');
+            uint64_t target = 0;
+            if (equals == std::string::npos || !parseField(field.substr(1, equals - 1), target) ||
+                !parseField(field.substr(equals + 1), value) || value > 255) {
+                return badLine(line);
+            }
+            if (field[0] == 'R' && target < REGISTER_COUNT) {
+                step.registerWrites.push_back({static_cast<int>(target), static_cast<Word>(value)});
+            } else if (field[0] == 'M' && target < memorySize) {
+                step.memoryWrites.push_back({static_cast<size_t>(target), static_cast<Word>(value)});
+            } else {
+                return badLine(line);
+            }
+        }
+        return true;
+    }
+
+    static void apply(const DeltaStep& step, Registers& registers, Memory& memory) {
+        for (const auto& write : step.registerWrites) {
+            registers.set(write.first, write.second);
+        }
+        for (const auto& write : step.memoryWrites) {
+            memory.write(write.first, write.second);
+        }
+    }
+
+private:
+    bool readLine(std::string& line) {
+        if (!std::getline(in, line)) return false;
+        ++lineNumber;
+        return true;
+    }
+    // Sets the error for a line that does not parse; false, for next() to return
+    bool badLine(const std::string& line) {
+        error = "malformed line " + std::to_string(lineNumber) + ": " + line;
+        return false;
+    }
+    // An unsigned decimal field: digits only, no sign, and a value that fits 64 bits
+    static bool parseField(const std::string& text, uint64_t& value) {
+        if (text.empty()) return false;
+        value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9' || value > (UINT64_MAX - (c - '0')) / 10) return false;
+            value = value * 10 + (c - '0');
+        }
+        return true;
+    }
+
+    std::istream& in;
+    std::string error;
+    uint64_t lineNumber = 0;
+    size_t memorySize = 0;
+    Word initialRegisters[REGISTER_COUNT] = {};
+    std::vector<std::pair<size_t, Word>> initialCells;
+    int haltProgramCounter = -1;
+};
+
+#endif
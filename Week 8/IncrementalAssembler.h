@@ -0,0 +1,176 @@
+// Incremental assembler for edit-run loops. It keeps the previous run's machine code
+// together with a hash of every source line. On the next run the lines are hashed, and
+// the unchanged prefix and suffix are matched by position and hash. Between them the
+// lines are matched one by one: a line whose hash is at the matching position of the
+// cache reuses its word, and after an inserted, deleted or replaced run of up to
+// RESYNC_WINDOW lines the match resumes at the shifted position. Only lines that match
+// nothing are encoded again, so edits far apart cost no more than the edited lines.
+//
+// The cache can be saved to a sidecar file so it survives between runs:
+//   "VCPUASC1", uint64 line count, uint64 hashes[count], int32 words[count]
+#ifndef VCPU_INCREMENTAL_ASSEMBLER_H
+#define VCPU_INCREMENTAL_ASSEMBLER_H
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Assembler.h"
+#include "MappedFile.h"
+#include "ObjectImage.h"
+
+const char ASSEMBLER_CACHE_MAGIC[8] = {'V', 'C', 'P', 'U', 'A', 'S', 'C', '1'};
+
+inline uint64_t lineHash(const char* begin, const char* end) {
+    return objectChecksum(begin, end - begin);
+}
+
+class IncrementalAssembler {
+public:
+    // Loads a saved cache; a missing or damaged file just leaves the cache empty
+    bool load(const std::string& path) {
+        clear();
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        std::string_view bytes = file.view();
+        uint64_t count = 0;
+        if (bytes.size() < 16 || memcmp(bytes.data(), ASSEMBLER_CACHE_MAGIC, 8) != 0) {
+            return false;
+        }
+        memcpy(&count, bytes.data() + 8, 8);
+        if (count > (bytes.size() - 16) / (sizeof(uint64_t) + sizeof(int)) ||
+            bytes.size() != 16 + count * (sizeof(uint64_t) + sizeof(int))) {
+            return false;
+        }
+        hashes.resize(count);
+        words.resize(count);
+        memcpy(hashes.data(), bytes.data() + 16, count * sizeof(uint64_t));
+        memcpy(words.data(), bytes.data() + 16 + count * sizeof(uint64_t), count * sizeof(int));
+        return true;
+    }
+
+    bool save(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        uint64_t count = words.size();
+        file.write(ASSEMBLER_CACHE_MAGIC, sizeof(ASSEMBLER_CACHE_MAGIC));
+        file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        file.write(reinterpret_cast<const char*>(hashes.data()), count * sizeof(uint64_t));
+        file.write(reinterpret_cast<const char*>(words.data()), count * sizeof(int));
+        return file.good();
+    }
+
+    void clear() {
+        hashes.clear();
+        words.clear();
+    }
+
+    // Returns the machine code for source, patched from the cached image
+    const std::vector<int>& assemble(std::string_view source) {
+        // Hash every line, remembering where the first line that differs from the cache starts
+        std::vector<uint64_t> newHashes;
+        newHashes.reserve(countLines(source));
+        size_t prefix = 0;
+        const char* firstChanged = source.data() + source.size();
+        forEachLine(source, [&](const char* begin, const char* end) {
+            uint64_t hash = lineHash(begin, end);
+            if (prefix == newHashes.size()) {
+                if (prefix < hashes.size() && hash == hashes[prefix]) {
+                    ++prefix;
+                } else {
+                    firstChanged = begin;
+                }
+            }
+            newHashes.push_back(hash);
+        });
+
+        size_t newCount = newHashes.size();
+        size_t oldCount = words.size();
+        size_t suffix = 0;
+        while (suffix < newCount - prefix && suffix < oldCount - prefix &&
+               newHashes[newCount - 1 - suffix] == hashes[oldCount - 1 - suffix]) {
+            ++suffix;
+        }
+        size_t newEnd = newCount - suffix;
+        size_t oldEnd = oldCount - suffix;
+
+        std::vector<int> patched(newCount);
+        std::copy(words.begin(), words.begin() + prefix, patched.begin());
+        std::copy(words.end() - suffix, words.end(), patched.end() - suffix);
+
+        // Lines between the prefix and suffix: i walks the new lines and j the cached ones
+        const char* line = firstChanged;
+        const char* sourceEnd = source.data() + source.size();
+        size_t lineIndex = prefix;
+        auto encode = [&](size_t index) {
+            for (; lineIndex < index; ++lineIndex) {
+                line = static_cast<const char*>(memchr(line, '\n', sourceEnd - line)) + 1;
+            }
+            const char* lineEnd = static_cast<const char*>(memchr(line, '\n', sourceEnd - line));
+            patched[index] = encodeLine(line, lineEnd == nullptr ? sourceEnd : lineEnd);
+        };
+        // New line i and cached line j start RESYNC_RUN agreeing lines (or agree up to the end)
+        auto agree = [&](size_t i, size_t j) {
+            for (size_t run = 0; run < RESYNC_RUN && i + run < newEnd && j + run < oldEnd; ++run) {
+                if (newHashes[i + run] != hashes[j + run]) return false;
+            }
+            return true;
+        };
+        size_t matched = 0;
+        size_t i = prefix;
+        size_t j = prefix;
+        while (i < newEnd) {
+            if (j < oldEnd && newHashes[i] == hashes[j]) {
+                patched[i++] = words[j++];
+                ++matched;
+                continue;
+            }
+            // Find the shortest run of replaced, inserted or deleted lines after which they agree again
+            size_t skipNew = 1;
+            size_t skipOld = 1;
+            for (size_t run = 1; run <= RESYNC_WINDOW; ++run) {
+                if (i + run < newEnd && j + run < oldEnd && agree(i + run, j + run)) {
+                    skipNew = skipOld = run;
+                    break;
+                }
+                if (i + run < newEnd && j < oldEnd && agree(i + run, j)) {
+                    skipNew = run;
+                    skipOld = 0;
+                    break;
+                }
+                if (j + run < oldEnd && agree(i, j + run)) {
+                    skipNew = 0;
+                    skipOld = run;
+                    break;
+                }
+            }
+            for (size_t end = std::min(i + skipNew, newEnd); i < end; ++i) {
+                encode(i);
+            }
+            j += skipOld;
+        }
+
+        words.swap(patched);
+        hashes.swap(newHashes);
+        reused = prefix + suffix + matched;
+        encoded = newCount - reused;
+        return words;
+    }
+
+    size_t linesReused() const { return reused; }
+    size_t linesEncoded() const { return encoded; }
+
+private:
+    static const size_t RESYNC_WINDOW = 256;  // longest inserted, deleted or replaced run matched past
+    static const size_t RESYNC_RUN = 4;       // lines that must agree before the match resumes
+
+    std::vector<uint64_t> hashes;  // hash of each source line of the cached image
+    std::vector<int> words;        // cached machine code, one word per line
+    size_t reused = 0;
+    size_t encoded = 0;
+};
+
+#endif
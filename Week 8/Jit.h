@@ -0,0 +1,339 @@
+// x86-64 JIT for hot basic blocks (Linux only; define VCPU_NO_JIT to leave it out).
+//
+// A block is the same unit the block engine uses: the instructions from an entry point
+// up to and including the next JUMP/CALL/RET. Each one is translated straight into
+// machine code. While native code runs, the eight guest registers live in host
+// registers (see HOST_REGISTER) and are written back to the register file on exit and
+// around runtime calls; rbx holds the JitState, r12 the register file and r13 the first
+// page of guest memory. ADD/SUB/LOAD/STORE and CALL/RET are inlined. INPUT/OUTPUT and
+// out-of-bounds memory accesses call back into the runtime through the function pointers in JitState. At
+// the end of a block the retired count is updated, the instruction limit is checked,
+// and control jumps straight to the target block's code. A target with no code yet
+// (or a halt) returns to the caller with the new program counter in JitState.
+//
+// Code lives in one mmap'd buffer that is never writable and executable at the same
+// time: the pages being written are switched to read-write for each translation.
+#ifndef VCPU_JIT_H
+#define VCPU_JIT_H
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(VCPU_NO_JIT)
+#define VCPU_HAVE_JIT 1
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Machine.h"
+
+// Everything the generated code reads or updates; offsets are baked into the code
+struct JitState {
+    Word* registers;
+    Word* memory;            // the first memory page, which holds every register-addressable cell
+    uint64_t memorySize;
+    Word* returnSlot;        // the last memory cell, where CALL leaves the return address
+    uint64_t retired;
+    uint64_t* retiredByType; // PerformanceCounters::retired, bumped once per block
+    uint64_t limit;
+    uint64_t pc;
+    const void** blockCode;  // native entry for each address, or nullptr
+    uint64_t programSize;
+    void* context;           // first argument of every callback
+    void (*input)(void* context, int reg);
+    void (*output)(void* context, int reg);
+    Word (*readOutOfBounds)(void* context, uint64_t address);
+    void (*writeOutOfBounds)(void* context, uint64_t address, Word value);
+};
+
+static_assert(sizeof(JitState) <= 128, "JitState fields are addressed with 8-bit displacements");
+
+// Host register holding each guest register: r8b-r11b, r14b, r15b, bpl, sil
+const uint8_t HOST_REGISTER[REGISTER_COUNT] = {8, 9, 10, 11, 14, 15, 5, 6};
+
+class JitCompiler {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 << 20;
+
+    explicit JitCompiler(size_t capacity = DEFAULT_CAPACITY) : capacity(capacity) {
+        void* address = mmap(nullptr, capacity, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        base = address == MAP_FAILED ? nullptr : static_cast<unsigned char*>(address);
+        reset();
+    }
+    ~JitCompiler() {
+        if (base != nullptr) {
+            munmap(base, capacity);
+        }
+    }
+    JitCompiler(const JitCompiler&) = delete;
+    JitCompiler& operator=(const JitCompiler&) = delete;
+
+    bool isReady() const { return base != nullptr; }
+
+    // Drops all translated code, keeping only the entry and exit stubs
+    void reset() {
+        used = 0;
+        if (base == nullptr || !beginWrite(256)) {
+            return;
+        }
+        // enter(state, code): save the callee-saved registers, load the guest registers, jump in
+        bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});  // push rbx, rbp, r12-r15
+        bytes({0x48, 0x83, 0xEC, 0x08});                            // sub rsp, 8 (keeps calls 16-byte aligned)
+        bytes({0x48, 0x89, 0xFB});                                  // mov rbx, rdi
+        bytes({0x48, 0x89, 0xF0});                                  // mov rax, rsi
+        bytes({0x4C, 0x8B, 0x63, offsetof(JitState, registers)});   // mov r12, [rbx+registers]
+        bytes({0x4C, 0x8B, 0x6B, offsetof(JitState, memory)});      // mov r13, [rbx+memory]
+        reloadRegisters();
+        bytes({0xFF, 0xE0});                                        // jmp rax
+        exitOffset = used;
+        spillRegisters();
+        bytes({0x48, 0x83, 0xC4, 0x08});                            // add rsp, 8
+        bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3});  // pop r15-r12, rbp, rbx; ret
+        endWrite();
+    }
+
+    // Native code for the block starting at start, or nullptr when the buffer is full
+    const void* translate(const DecodedInstruction* program, size_t programSize, size_t start, uint64_t memorySize) {
+        size_t end = start;
+        while (end < programSize && !isTransfer(program[end].type)) ++end;
+        bool endsInTransfer = end < programSize;
+        size_t count = end - start + (endsInTransfer ? 1 : 0);
+        if (base == nullptr || !beginWrite(count * MAX_INSTRUCTION_BYTES + MAX_TAIL_BYTES)) {
+            return nullptr;
+        }
+        const void* entry = base + used;
+        // Addresses come from 8-bit registers, so memories of 256+ cells need no bounds checks
+        bool checkBounds = memorySize <= 255;
+        for (size_t i = start; i < end; ++i) {
+            emitInstruction(program[i], checkBounds);
+        }
+        if (endsInTransfer) {
+            emitTransfer(program[end], end);
+        }
+        emitRetire(count);
+        emitCounters(program + start, count);
+        if (endsInTransfer) {
+            emitDispatch();
+        } else {
+            bytes({0x48, 0xC7, 0x43, offsetof(JitState, pc)});     // mov qword [rbx+pc], programSize
+            int32(static_cast<int32_t>(programSize));
+            jumpToExit(0);
+        }
+        endWrite();
+        return entry;
+    }
+
+    // Runs native code from entry until the program halts, reaches the instruction
+    // limit or transfers to a block that has no code yet
+    void run(JitState& state, const void* entry) {
+        reinterpret_cast<void (*)(JitState*, const void*)>(base)(&state, entry);
+    }
+
+private:
+    static const size_t MAX_INSTRUCTION_BYTES = 128;
+    static const size_t MAX_TAIL_BYTES = 192;
+
+    static bool isTransfer(InstructionType type) { return type == JUMP || type == CALL || type == RET; }
+
+    // Makes the pages that the next size bytes land on writable
+    bool beginWrite(size_t size) {
+        if (size > capacity - used) {
+            return false;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        writeBegin = used / page * page;
+        writeEnd = (used + size + page - 1) / page * page;
+        return mprotect(base + writeBegin, writeEnd - writeBegin, PROT_READ | PROT_WRITE) == 0;
+    }
+    void endWrite() { mprotect(base + writeBegin, writeEnd - writeBegin, PROT_READ | PROT_EXEC); }
+
+    void bytes(std::initializer_list<uint8_t> list) {
+        for (uint8_t b : list) base[used++] = b;
+    }
+    void int32(int32_t value) {
+        memcpy(base + used, &value, 4);
+        used += 4;
+    }
+    // jmp (condition 0) or jcc rel32 to the exit stub
+    void jumpToExit(uint8_t condition) {
+        if (condition == 0) {
+            bytes({0xE9});
+        } else {
+            bytes({0x0F, condition});
+        }
+        int32(static_cast<int32_t>(exitOffset - (used + 4)));
+    }
+    // mov rdi, [rbx+context]; then the caller loads the other arguments and calls
+    void loadContext() { bytes({0x48, 0x8B, 0x7B, offsetof(JitState, context)}); }
+    void callRuntime(uint8_t offset) { bytes({0xFF, 0x53, offset}); }  // call [rbx+offset]
+
+    // Emits a short forward jump and returns where its displacement goes
+    size_t jumpForward(uint8_t opcode) {
+        bytes({opcode, 0x00});
+        return used - 1;
+    }
+    void landJump(size_t displacement) { base[displacement] = static_cast<uint8_t>(used - (displacement + 1)); }
+
+    static uint8_t rex(uint8_t reg, uint8_t rm) { return 0x40 | ((reg >> 3) << 2) | (rm >> 3); }
+    static uint8_t hostRegister(int guest) { return HOST_REGISTER[guest]; }
+
+    // op r/m8, r8 between the low bytes of two registers (rax is 0)
+    void byteOp(uint8_t opcode, uint8_t rm, uint8_t reg) {
+        bytes({rex(reg, rm), opcode, static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7))});
+    }
+    // movzx reg32, r/m8
+    void zeroExtend(uint8_t reg, uint8_t rm) {
+        bytes({rex(reg, rm), 0x0F, 0xB6, static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7))});
+    }
+    // opcode with reg and [r13+rax] (0x8A loads, 0x88 stores)
+    void guestMemoryOp(uint8_t opcode, uint8_t reg) {
+        bytes({rex(reg, 13), opcode, static_cast<uint8_t>(0x44 | ((reg & 7) << 3)), 0x05, 0x00});
+    }
+    // The register file at [r12+guest] (0x88 spills, 0x8A reloads)
+    void registerFileOp(uint8_t opcode, int guest) {
+        uint8_t host = hostRegister(guest);
+        bytes({rex(host, 12), opcode, static_cast<uint8_t>(0x44 | ((host & 7) << 3)), 0x24, static_cast<uint8_t>(guest)});
+    }
+    void spillRegisters() {
+        for (int i = 0; i < REGISTER_COUNT; ++i) registerFileOp(0x88, i);
+    }
+    void reloadRegisters() {
+        for (int i = 0; i < REGISTER_COUNT; ++i) registerFileOp(0x8A, i);
+    }
+
+    void emitInstruction(const DecodedInstruction& instruction, bool checkBounds) {
+        uint8_t r1 = hostRegister(instruction.reg1);
+        uint8_t r2 = hostRegister(instruction.reg2);
+        switch (instruction.type) {
+            case ADD:
+                byteOp(0x00, r1, r2);                               // add r1b, r2b
+                break;
+            case SUB:
+                byteOp(0x28, r1, r2);                               // sub r1b, r2b
+                break;
+            case LOAD: {
+                zeroExtend(0, r2);                                  // movzx eax, r2b
+                if (!checkBounds) {
+                    guestMemoryOp(0x8A, r1);                        // mov r1b, [r13+rax]
+                    break;
+                }
+                bytes({0x48, 0x3B, 0x43, offsetof(JitState, memorySize)});  // cmp rax, [rbx+memorySize]
+                size_t outOfBounds = jumpForward(0x73);             // jae out_of_bounds
+                guestMemoryOp(0x8A, r1);                            // mov r1b, [r13+rax]
+                size_t done = jumpForward(0xEB);                    // jmp done
+                landJump(outOfBounds);
+                spillRegisters();
+                loadContext();
+                bytes({0x89, 0xC6});                                // mov esi, eax
+                callRuntime(offsetof(JitState, readOutOfBounds));
+                reloadRegisters();
+                byteOp(0x88, r1, 0);                                // mov r1b, al
+                landJump(done);
+                break;
+            }
+            case STORE: {
+                zeroExtend(0, r2);                                  // movzx eax, r2b
+                if (!checkBounds) {
+                    guestMemoryOp(0x88, r1);                        // mov [r13+rax], r1b
+                    break;
+                }
+                bytes({0x48, 0x3B, 0x43, offsetof(JitState, memorySize)});  // cmp rax, [rbx+memorySize]
+                size_t outOfBounds = jumpForward(0x73);             // jae out_of_bounds
+                guestMemoryOp(0x88, r1);                            // mov [r13+rax], r1b
+                size_t done = jumpForward(0xEB);                    // jmp done
+                landJump(outOfBounds);
+                spillRegisters();
+                zeroExtend(2, r1);                                  // movzx edx, r1b (before esi is reused)
+                loadContext();
+                bytes({0x89, 0xC6});                                // mov esi, eax
+                callRuntime(offsetof(JitState, writeOutOfBounds));
+                reloadRegisters();
+                landJump(done);
+                break;
+            }
+            case INPUT:
+            case OUTPUT:
+                spillRegisters();
+                loadContext();
+                bytes({0xBE});                                      // mov esi, reg1
+                int32(instruction.reg1);
+                callRuntime(instruction.type == INPUT ? offsetof(JitState, input) : offsetof(JitState, output));
+                reloadRegisters();
+                break;
+            default:
+                // UNKNOWN clears reg1, like the ALU's default case
+                bytes({rex(0, r1), static_cast<uint8_t>(0xB0 | (r1 & 7)), 0x00});  // mov r1b, 0
+                break;
+        }
+    }
+
+    // Leaves the transfer target in rax
+    void emitTransfer(const DecodedInstruction& instruction, size_t address) {
+        if (instruction.type == RET) {
+            bytes({0x48, 0x8B, 0x4B, offsetof(JitState, returnSlot)});  // mov rcx, [rbx+returnSlot]
+            bytes({0x0F, 0xB6, 0x01});                                // movzx eax, byte [rcx]
+            return;
+        }
+        if (instruction.type == CALL) {
+            // The return address is stored in the last memory cell, truncated to a Word
+            bytes({0x48, 0x8B, 0x4B, offsetof(JitState, returnSlot)});  // mov rcx, [rbx+returnSlot]
+            bytes({0xC6, 0x01, static_cast<uint8_t>(address + 1)});  // mov byte [rcx], imm8
+        }
+        zeroExtend(0, hostRegister(instruction.reg2));              // movzx eax, r2b
+    }
+
+    void emitRetire(size_t count) {
+        if (count < 128) {
+            bytes({0x48, 0x83, 0x43, offsetof(JitState, retired), static_cast<uint8_t>(count)});  // add qword [rbx+retired], imm8
+        } else {
+            bytes({0x48, 0x81, 0x43, offsetof(JitState, retired)});  // add qword [rbx+retired], imm32
+            int32(static_cast<int32_t>(count));
+        }
+    }
+
+    // Adds the block's instructions of each type to the performance counters (rax is live)
+    void emitCounters(const DecodedInstruction* block, size_t count) {
+        uint32_t types[UNKNOWN + 1] = {};
+        for (size_t i = 0; i < count; ++i) {
+            ++types[block[i].type];
+        }
+        bytes({0x48, 0x8B, 0x4B, offsetof(JitState, retiredByType)});  // mov rcx, [rbx+retiredByType]
+        for (int type = 0; type <= UNKNOWN; ++type) {
+            if (types[type] == 0) continue;
+            uint8_t offset = static_cast<uint8_t>(type * sizeof(uint64_t));
+            if (types[type] < 128) {
+                bytes({0x48, 0x83, 0x41, offset, static_cast<uint8_t>(types[type])});  // add qword [rcx+offset], imm8
+            } else {
+                bytes({0x48, 0x81, 0x41, offset});                    // add qword [rcx+offset], imm32
+                int32(static_cast<int32_t>(types[type]));
+            }
+        }
+    }
+
+    // Stores the target in rax as the program counter and chains to its code if there is any
+    void emitDispatch() {
+        bytes({0x48, 0x89, 0x43, offsetof(JitState, pc)});          // mov [rbx+pc], rax
+        bytes({0x48, 0x8B, 0x4B, offsetof(JitState, retired)});     // mov rcx, [rbx+retired]
+        bytes({0x48, 0x3B, 0x4B, offsetof(JitState, limit)});       // cmp rcx, [rbx+limit]
+        jumpToExit(0x83);                                           // jae exit
+        bytes({0x48, 0x3B, 0x43, offsetof(JitState, programSize)}); // cmp rax, [rbx+programSize]
+        jumpToExit(0x83);                                           // jae exit
+        bytes({0x48, 0x8B, 0x4B, offsetof(JitState, blockCode)});   // mov rcx, [rbx+blockCode]
+        bytes({0x48, 0x8B, 0x0C, 0xC1});                            // mov rcx, [rcx+rax*8]
+        bytes({0x48, 0x85, 0xC9});                                  // test rcx, rcx
+        jumpToExit(0x84);                                           // jz exit
+        bytes({0xFF, 0xE1});                                        // jmp rcx
+    }
+
+    unsigned char* base;
+    size_t capacity;
+    size_t used = 0;
+    size_t exitOffset = 0;
+    size_t writeBegin = 0;
+    size_t writeEnd = 0;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,229 @@
+// Lockstep execution of one program over many contexts ("lanes"), for parameter sweeps
+// that run the same machine code from different initial registers and memory.
+//
+// A LockstepGroup holds LOCKSTEP_LANES contexts in structure-of-arrays form: each guest
+// register is an array with one byte per lane, and memory cell i of every lane sits in
+// memory[i * LOCKSTEP_LANES + lane]. Each instruction is dispatched once for the whole
+// group. The ALU ops are plain loops over the lane arrays with a lane mask, which the
+// compiler vectorizes (SSE2 by default, AVX2 with -march=native).
+//
+// Lanes diverge when a JUMP/CALL/RET sends them to different addresses. The group then
+// runs the lanes at the lowest program counter and lets the others wait. Lanes merge
+// again as soon as the running ones reach a waiting lane's address, so code after a
+// branch that rejoins runs for all lanes at once again.
+#ifndef VCPU_LOCKSTEP_H
+#define VCPU_LOCKSTEP_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "Machine.h"
+#include "PerformanceCounters.h"
+
+const int LOCKSTEP_LANES = 32;
+// Lanes keep dense memory, LOCKSTEP_LANES bytes per cell, so sweeps are limited to this many cells
+const size_t LOCKSTEP_MAX_MEMORY = 16 * 1024;
+
+// Initial state of one lane
+struct LaneSetup {
+    Word registers[REGISTER_COUNT] = {0, 4, 9, 10};
+    std::vector<std::pair<size_t, Word>> memory;  // cells to preset, as (address, value)
+};
+
+class LockstepGroup {
+public:
+    // lanes <= LOCKSTEP_LANES and memorySize <= LOCKSTEP_MAX_MEMORY; the remaining lanes
+    // stay idle. Console messages number the lanes from firstLane, their position in the
+    // whole sweep.
+    LockstepGroup(const std::vector<DecodedInstruction>& program, size_t memorySize, int lanes, size_t firstLane = 0)
+        : program(program), memorySize(memorySize), firstLane(firstLane),
+          memory(memorySize * LOCKSTEP_LANES) {
+        for (int reg = 0; reg < REGISTER_COUNT; ++reg) {
+            std::fill(registers[reg], registers[reg] + LOCKSTEP_LANES, 0);
+        }
+        for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+            pc[lane] = 0;
+            retired[lane] = 0;
+            live[lane] = lane < lanes;
+        }
+    }
+
+    // Copies the same initial data into every lane's memory; false if it does not fit
+    bool loadData(uint64_t address, const Word* data, size_t size) {
+        if (address > memorySize || size > memorySize - address) return false;
+        for (size_t i = 0; i < size; ++i) {
+            std::fill_n(&memory[(address + i) * LOCKSTEP_LANES], LOCKSTEP_LANES, data[i]);
+        }
+        return true;
+    }
+
+    // Returns false if a preset memory cell is out of range
+    bool setLane(int lane, const LaneSetup& setup) {
+        for (int reg = 0; reg < REGISTER_COUNT; ++reg) {
+            registers[reg][lane] = setup.registers[reg];
+        }
+        for (const auto& cell : setup.memory) {
+            if (cell.first >= memorySize) return false;
+            memory[cell.first * LOCKSTEP_LANES + lane] = cell.second;
+        }
+        return true;
+    }
+
+    // Runs every lane until it halts or reaches instructionLimit at a JUMP/CALL/RET.
+    // INPUT reads one value per running lane, in lane order.
+    void run(uint64_t instructionLimit, std::istream& input, std::ostream& console) {
+        const int programSize = program.size();
+        for (;;) {
+            // The live lanes at the lowest program counter run; the others wait
+            int current = INT_MAX;
+            for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                if (live[lane]) current = std::min(current, pc[lane]);
+            }
+            if (current == INT_MAX) {
+                return;
+            }
+            int waiting = INT_MAX;
+            int running = 0;
+            for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                bool runs = live[lane] && pc[lane] == current;
+                mask[lane] = runs ? 0xFF : 0;
+                running += runs;
+                if (live[lane] && !runs) waiting = std::min(waiting, pc[lane]);
+            }
+
+            // Straight-line code under this mask, until a transfer, the end of the program
+            // or the address of a waiting lane
+            int start = current;
+            bool transferred = false;
+            while (current < programSize && current != waiting && !transferred) {
+                const DecodedInstruction& instruction = program[current++];
+                groupSteps++;
+                counters.retired[instruction.type] += running;
+                transferred = execute(instruction, current, input, console);
+            }
+            int length = current - start;
+            for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                if (!mask[lane]) continue;
+                retired[lane] += length;
+                if (!transferred) pc[lane] = current;
+                if (pc[lane] >= programSize || (transferred && retired[lane] >= instructionLimit)) {
+                    live[lane] = false;
+                }
+            }
+        }
+    }
+
+    Word registerValue(int lane, int reg) const { return registers[reg][lane]; }
+    Word memoryValue(int lane, size_t address) const { return memory[address * LOCKSTEP_LANES + lane]; }
+    uint64_t instructionsRetired(int lane) const { return retired[lane]; }
+    // Instructions dispatched for the whole group; retired / steps is the average lanes per dispatch
+    uint64_t steps() const { return groupSteps; }
+    // Summed over the lanes; the caller fills in the host time
+    const PerformanceCounters& performanceCounters() const { return counters; }
+
+private:
+    // Runs one instruction for the masked lanes; returns true for a control transfer,
+    // which leaves each lane's target in pc[lane]
+    bool execute(const DecodedInstruction& instruction, int next, std::istream& input, std::ostream& console) {
+        Word* r1 = registers[instruction.reg1];
+        const Word* r2 = registers[instruction.reg2];
+        switch (instruction.type) {
+            case ADD:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    Word sum = r1[lane] + r2[lane];
+                    r1[lane] = (sum & mask[lane]) | (r1[lane] & ~mask[lane]);
+                }
+                return false;
+            case SUB:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    Word difference = r1[lane] - r2[lane];
+                    r1[lane] = (difference & mask[lane]) | (r1[lane] & ~mask[lane]);
+                }
+                return false;
+            case LOAD:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (mask[lane]) r1[lane] = read(lane, r2[lane], console);
+                }
+                return false;
+            case STORE:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (mask[lane]) write(lane, r2[lane], r1[lane], console);
+                }
+                return false;
+            case INPUT:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (!mask[lane]) continue;
+                    int value = 0;
+                    console << "Lane " << firstLane + lane << ": Enter value for R" << static_cast<int>(instruction.reg1) << ": ";
+                    input >> value;
+                    r1[lane] = value;
+                }
+                return false;
+            case OUTPUT:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (!mask[lane]) continue;
+                    console << "Lane " << firstLane + lane << ": Output value from R" << static_cast<int>(instruction.reg1) << ": "
+                            << static_cast<int>(r1[lane]) << std::endl;
+                }
+                return false;
+            case JUMP:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (mask[lane]) pc[lane] = r2[lane];
+                }
+                return true;
+            case CALL:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (!mask[lane]) continue;
+                    write(lane, memorySize - 1, static_cast<Word>(next), console);
+                    pc[lane] = r2[lane];
+                }
+                return true;
+            case RET:
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    if (mask[lane]) pc[lane] = read(lane, memorySize - 1, console);
+                }
+                return true;
+            default:
+                // UNKNOWN clears reg1, like the ALU's default case
+                for (int lane = 0; lane < LOCKSTEP_LANES; ++lane) {
+                    r1[lane] &= ~mask[lane];
+                }
+                return false;
+        }
+    }
+
+    Word read(int lane, size_t address, std::ostream& console) {
+        if (address >= memorySize) {
+            counters.loadsOutOfBounds++;
+            console << "Lane " << firstLane + lane << ": Memory read error: Address out of bounds" << std::endl;
+            return static_cast<Word>(-1);
+        }
+        return memory[address * LOCKSTEP_LANES + lane];
+    }
+    void write(int lane, size_t address, Word value, std::ostream& console) {
+        if (address >= memorySize) {
+            counters.storesOutOfBounds++;
+            console << "Lane " << firstLane + lane << ": Memory write error: Address out of bounds" << std::endl;
+            return;
+        }
+        memory[address * LOCKSTEP_LANES + lane] = value;
+    }
+
+    const std::vector<DecodedInstruction>& program;
+    size_t memorySize;
+    size_t firstLane;
+    alignas(32) Word registers[REGISTER_COUNT][LOCKSTEP_LANES];
+    alignas(32) Word mask[LOCKSTEP_LANES];
+    std::vector<Word> memory;
+    int pc[LOCKSTEP_LANES];
+    uint64_t retired[LOCKSTEP_LANES];
+    bool live[LOCKSTEP_LANES];
+    uint64_t groupSteps = 0;
+    PerformanceCounters counters;
+};
+
+#endif
@@ -0,0 +1,258 @@
+// Architectural state shared by the emulator and the trace tools: instruction
+// encoding, the register file and guest memory.
+#ifndef VCPU_MACHINE_H
+#define VCPU_MACHINE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+enum InstructionType : uint8_t { ADD, SUB, LOAD, STORE, INPUT, OUTPUT, JUMP, CALL, RET, UNKNOWN };
+
+// Instruction word layout: opcode in bits 6-9, reg1 in bits 3-5, reg2 in bits 0-2
+const int OPCODE_SHIFT = 6;
+const int OPCODE_MASK = 0x0F;
+const int REG_MASK = 0x07;
+
+// Instruction fields extracted once by loadProgram so the execute loop never re-decodes
+struct DecodedInstruction {
+    InstructionType type;
+    uint8_t reg1;
+    uint8_t reg2;
+    int word;  // original machine word, kept for the trace output
+};
+
+inline DecodedInstruction decodeInstruction(int instruction) {
+    int opcode = (instruction >> OPCODE_SHIFT) & OPCODE_MASK;
+    DecodedInstruction decoded;
+    decoded.type = opcode <= RET ? static_cast<InstructionType>(opcode) : UNKNOWN;
+    decoded.reg1 = (instruction >> 3) & REG_MASK;
+    decoded.reg2 = instruction & REG_MASK;
+    decoded.word = instruction;
+    return decoded;
+}
+
+inline const char* opcodeName(InstructionType type) {
+    static const char* const names[] = {"ADD", "SUB", "LOAD", "STORE", "INPUT", "OUTPUT", "JUMP", "CALL", "RET", "UNKNOWN"};
+    return names[type];
+}
+
+// Data word: 8 bits, so register arithmetic wraps exactly like the old bitset<8> strings
+typedef uint8_t Word;
+
+// General-purpose registers class: one slot per value of the 3-bit register field
+const int REGISTER_COUNT = 8;
+const int NAMED_REGISTERS = 4;  // R0-R3, the registers the assembler can name
+
+class Registers {
+public:
+    Word regs[REGISTER_COUNT];
+    Registers() : regs{0, 4, 9, 10} {}
+    Word get(int reg) const { return regs[reg]; }
+    void set(int reg, Word value) { regs[reg] = value; }
+    void display(std::ostream& outputStream) const {
+        for (int i = 0; i < NAMED_REGISTERS; ++i) {
+            outputStream << "R" << i << ": " << static_cast<int>(regs[i]) << " ";
+        }
+        outputStream << '\n';
+    }
+};
+
+// Memory management class: sparse paged guest memory. Cells live in 4 KiB pages, and a
+// two-level table maps them: a directory with one entry per 512 pages, each pointing at a
+// PageTable. Pages and tables are held through shared_ptr. Unmapped memory points at one
+// shared zero page (and zero table), so it reads as zero and costs nothing until written.
+// A write to a page or table that is shared (the zero ones, or ones also held by a
+// snapshot) first copies it, which makes snapshots copy-on-write.
+class Memory {
+public:
+    static const int PAGE_BITS = 12;
+    static const size_t PAGE_SIZE = size_t(1) << PAGE_BITS;  // cells per page
+    static const size_t PAGE_MASK = PAGE_SIZE - 1;
+    static const int TABLE_BITS = 9;
+    static const size_t TABLE_SIZE = size_t(1) << TABLE_BITS;  // pages per page table
+    static const size_t TABLE_MASK = TABLE_SIZE - 1;
+    struct Page {
+        Word cells[PAGE_SIZE];
+    };
+    struct PageTable {
+        std::shared_ptr<Page> pages[TABLE_SIZE];
+    };
+    typedef std::vector<std::shared_ptr<PageTable>> PageDirectory;
+    // What snapshot() captures and restore() puts back
+    struct Snapshot {
+        PageDirectory directory;
+        size_t residentPages = 0;
+    };
+
+    explicit Memory(size_t size)
+        : directory((size + (PAGE_SIZE << TABLE_BITS) - 1) / (PAGE_SIZE << TABLE_BITS), zeroTable()),
+          cellCount(size), firstPageSize(std::min(size, PAGE_SIZE)), resident(0) {
+        cacheFirstPage();
+    }
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+
+    std::ostream* diagnostics = &std::cout;  // where out-of-bounds accesses are reported
+
+    size_t size() const { return cellCount; }
+    size_t pageCount() const { return (cellCount + PAGE_MASK) / PAGE_SIZE; }
+    // Pages written at least once, i.e. backed by memory of their own
+    size_t residentPages() const { return resident; }
+    // Accesses rejected as out of bounds so far; snapshots do not rewind them
+    uint64_t readsOutOfBounds() const { return badReads; }
+    uint64_t writesOutOfBounds() const { return badWrites; }
+
+    // Unchecked access for callers that have already checked the address
+    Word at(size_t address) const {
+        size_t page = address >> PAGE_BITS;
+        return directory[page >> TABLE_BITS]->pages[page & TABLE_MASK]->cells[address & PAGE_MASK];
+    }
+    Word read(size_t address) const {
+        if (address < firstPageSize) {
+            return firstPage[address];
+        }
+        return readPaged(address);
+    }
+    bool write(size_t address, Word value) {
+        if (address < firstPageSize && ownedFirstPage != nullptr) {
+            ownedFirstPage[address] = value;
+            return true;
+        }
+        return writePaged(address, value);
+    }
+    // Copies size bytes to address; the caller checks that they fit
+    void writeBlock(size_t address, const Word* data, size_t size) {
+        while (size > 0) {
+            size_t count = std::min(size, PAGE_SIZE - (address & PAGE_MASK));
+            memcpy(writableCell(address), data, count);
+            address += count;
+            data += count;
+            size -= count;
+        }
+    }
+    // Where a cell is stored right now, for reading only: possibly a shared or zero page,
+    // so the pointer goes stale once the page is written
+    const Word* readableCell(size_t address) const {
+        size_t page = address >> PAGE_BITS;
+        return directory[page >> TABLE_BITS]->pages[page & TABLE_MASK]->cells + (address & PAGE_MASK);
+    }
+    // A cell that can be written directly, together with the rest of its page (the JIT
+    // works on cells obtained this way). Copies the page and its table first if shared.
+    Word* writableCell(size_t address) {
+        size_t page = address >> PAGE_BITS;
+        std::shared_ptr<PageTable>& table = directory[page >> TABLE_BITS];
+        if (table.use_count() != 1) {
+            table = std::make_shared<PageTable>(*table);
+        }
+        std::shared_ptr<Page>& entry = table->pages[page & TABLE_MASK];
+        if (entry.use_count() != 1) {
+            if (entry == zeroPage()) ++resident;
+            entry = std::make_shared<Page>(*entry);
+            if (page == 0) cacheFirstPage();
+        }
+        return entry->cells + (address & PAGE_MASK);
+    }
+    // Calls visit(address, value) for every non-zero cell, skipping unmapped pages
+    template <class Visitor>
+    void forEachNonZero(Visitor visit) const {
+        for (size_t t = 0; t < directory.size(); ++t) {
+            if (directory[t] == zeroTable()) continue;
+            for (size_t p = 0; p < TABLE_SIZE; ++p) {
+                const std::shared_ptr<Page>& page = directory[t]->pages[p];
+                if (page == zeroPage()) continue;
+                size_t first = ((t << TABLE_BITS) + p) << PAGE_BITS;
+                size_t end = std::min(cellCount, first + PAGE_SIZE);
+                for (size_t address = first; address < end; ++address) {
+                    Word value = page->cells[address - first];
+                    if (value != 0) visit(address, value);
+                }
+            }
+        }
+    }
+
+    // Copy-on-write snapshots: taking or restoring one copies a pointer per page table
+    Snapshot snapshot() const {
+        ownedFirstPage = nullptr;  // shared from now on
+        return {directory, resident};
+    }
+    void restore(const Snapshot& snapshot) {
+        directory = snapshot.directory;
+        resident = snapshot.residentPages;
+        cacheFirstPage();
+    }
+
+    void display(std::ostream& outputStream) const {
+        for (size_t i = 0; i < cellCount; ++i) {
+            outputStream << "Address " << i << ": " << static_cast<int>(at(i)) << " ";
+        }
+        outputStream << '\n';
+    }
+
+private:
+    static const std::shared_ptr<Page>& zeroPage() {
+        static const std::shared_ptr<Page> page = std::make_shared<Page>();
+        return page;
+    }
+    static const std::shared_ptr<PageTable>& zeroTable() {
+        static const std::shared_ptr<PageTable> table = [] {
+            std::shared_ptr<PageTable> zero = std::make_shared<PageTable>();
+            std::fill(zero->pages, zero->pages + TABLE_SIZE, zeroPage());
+            return zero;
+        }();
+        return table;
+    }
+
+    Word readPaged(size_t address) const {
+        if (address >= cellCount) {
+            ++badReads;
+            *diagnostics << "Memory read error: Address out of bounds" << std::endl;
+            return static_cast<Word>(-1);
+        }
+        return at(address);
+    }
+    bool writePaged(size_t address, Word value) {
+        if (address >= cellCount) {
+            ++badWrites;
+            *diagnostics << "Memory write error: Address out of bounds" << std::endl;
+            return false;
+        }
+        *writableCell(address) = value;
+        return true;
+    }
+
+    // Registers only address the first page, so reads and writes there skip the page
+    // table: firstPage always points at its cells, ownedFirstPage only while it is unshared
+    void cacheFirstPage() {
+        if (directory.empty()) {
+            firstPage = ownedFirstPage = nullptr;
+            return;
+        }
+        const std::shared_ptr<Page>& page = directory[0]->pages[0];
+        firstPage = page->cells;
+        ownedFirstPage = directory[0].use_count() == 1 && page.use_count() == 1 ? page->cells : nullptr;
+    }
+
+    PageDirectory directory;
+    size_t cellCount;
+    size_t firstPageSize;
+    size_t resident;
+    const Word* firstPage;
+    mutable Word* ownedFirstPage;
+    mutable uint64_t badReads = 0;
+    uint64_t badWrites = 0;
+};
+
+// Addresses come from 8-bit registers, so they always fall in the first page
+static_assert(Memory::PAGE_SIZE >= 256, "the first page must hold every register-addressable cell");
+
+const size_t DEFAULT_MEMORY_SIZE = 25;
+// Largest guest memory: 1 TiB keeps the page directory at 8 MiB
+const size_t MAX_MEMORY_SIZE = size_t(1) << 40;
+
+#endif
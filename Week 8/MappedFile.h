@@ -0,0 +1,90 @@
+// Read-only view of a whole input file. Regular files are mapped with mmap, so the
+// assembler reads the page cache directly instead of a copy. Standard input ("-"),
+// pipes and platforms without mmap fall back to reading the stream into memory.
+#ifndef VCPU_MAPPED_FILE_H
+#define VCPU_MAPPED_FILE_H
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define VCPU_HAVE_MMAP 1
+#endif
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Opens path ("-" for standard input); returns false if it cannot be read
+    bool open(const std::string& path) {
+        close();
+        if (path == "-") {
+            return readStream(std::cin);
+        }
+#ifdef VCPU_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            if (info.st_size == 0) {
+                ::close(fd);
+                mapped = true;
+                return true;
+            }
+            void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED) {
+                ::close(fd);
+                madvise(address, info.st_size, MADV_SEQUENTIAL);
+                mapping = static_cast<const char*>(address);
+                mappingSize = info.st_size;
+                mapped = true;
+                return true;
+            }
+        }
+        ::close(fd);
+#endif
+        std::ifstream stream(path, std::ios::binary);
+        return stream.is_open() && readStream(stream);
+    }
+
+    std::string_view view() const {
+        return mapped ? std::string_view(mapping, mappingSize) : std::string_view(contents);
+    }
+
+    void close() {
+#ifdef VCPU_HAVE_MMAP
+        if (mapping != nullptr) {
+            munmap(const_cast<char*>(mapping), mappingSize);
+        }
+#endif
+        mapping = nullptr;
+        mappingSize = 0;
+        mapped = false;
+        contents.clear();
+    }
+
+private:
+    bool readStream(std::istream& stream) {
+        contents.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        return !stream.bad();
+    }
+
+    const char* mapping = nullptr;
+    size_t mappingSize = 0;
+    bool mapped = false;
+    std::string contents;  // fallback copy when the input cannot be mapped
+};
+
+#endif
@@ -0,0 +1,76 @@
+// Trace policy that feeds the models attached to a run instead of writing a trace.
+// It sees the same hooks as the text traces, so every engine drives the models the
+// same way. Models that are not attached are skipped.
+#ifndef VCPU_MODEL_TRACE_H
+#define VCPU_MODEL_TRACE_H
+
+#include "BranchPredictor.h"
+#include "CacheModel.h"
+#include "Machine.h"
+#include "OutOfOrderModel.h"
+#include "PipelineModel.h"
+
+// The models a run can drive; null members are not attached
+struct Models {
+    CacheHierarchy* cache = nullptr;
+    BranchModel* branches = nullptr;
+    PipelineModel* pipeline = nullptr;
+    OutOfOrderModel* outOfOrder = nullptr;
+
+    bool any() const { return cache != nullptr || branches != nullptr || pipeline != nullptr || outOfOrder != nullptr; }
+};
+
+class TraceModels {
+public:
+    TraceModels(const Models& models, const Memory& memory) : models(models), memorySize(memory.size()) {}
+    void fetch(int address, const DecodedInstruction& instruction) {
+        pc = address;
+        current = instruction;
+        next = address + 1;
+        accessed = OutOfOrderModel::NO_ADDRESS;
+    }
+    void decode(const DecodedInstruction&, Word, Word operand2) { address = operand2; }
+    void input(int, int) {}
+    void output(int, int) {}
+    void jump(Word target) { transfer(JUMP, target); }
+    // CALL and RET keep the return address in the last memory cell
+    void call(Word target) {
+        dataAccess(memorySize - 1, true);
+        transfer(CALL, target);
+    }
+    void ret(int target) {
+        dataAccess(memorySize - 1, false);
+        transfer(RET, target);
+    }
+    void load(int, Word) { dataAccess(address, false); }
+    void store(Word, Word target) { dataAccess(target, true); }
+    void alu(const DecodedInstruction&, Word) {}
+    void memoryWrite(size_t, Word) {}
+    void retire(const Registers&, const Memory&) {
+        if (models.pipeline != nullptr) models.pipeline->issue(pc, current, next);
+        if (models.outOfOrder != nullptr) models.outOfOrder->issue(pc, current, next, accessed);
+    }
+    void halt(int) {}
+
+private:
+    // Out-of-bounds accesses never reach memory, so the models do not see them either
+    void dataAccess(size_t target, bool write) {
+        if (target >= memorySize) return;
+        accessed = target;
+        if (models.cache != nullptr) models.cache->access(pc, target, write);
+    }
+    void transfer(InstructionType type, int target) {
+        next = target;
+        if (models.branches != nullptr) models.branches->transfer(pc, type, target);
+    }
+
+    Models models;
+    size_t memorySize;
+    int pc = 0;
+    DecodedInstruction current = {};
+    int next = 0;      // address that runs after the current instruction
+    Word address = 0;  // operand2 of the current instruction: the LOAD address
+    size_t accessed = 0;  // memory cell the current instruction read or wrote
+};
+
+#endif
@@ -0,0 +1,133 @@
+// Object image: an assembled program saved to disk so it can be loaded with one mmap
+// instead of re-parsing the source. All fields are in host byte order.
+//
+//   ObjectHeader                 (64 bytes)
+//   code section                 int32 machine words, 8-byte aligned
+//   data section                 initial guest memory bytes, 8-byte aligned
+//
+// The checksum covers both sections, so a truncated or modified file is rejected.
+#ifndef VCPU_OBJECT_IMAGE_H
+#define VCPU_OBJECT_IMAGE_H
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Machine.h"
+#include "MappedFile.h"
+
+static_assert(sizeof(int) == 4, "object images store instruction words as 32-bit ints");
+
+const char OBJECT_MAGIC[8] = {'V', 'C', 'P', 'U', 'O', 'B', 'J', '1'};
+const uint32_t OBJECT_VERSION = 1;
+
+struct ObjectHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t codeOffset;
+    uint64_t codeWords;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t dataAddress;  // guest memory address the data section is loaded at
+    uint64_t checksum;
+};
+
+static_assert(sizeof(ObjectHeader) == 64, "object header layout is fixed");
+
+// 64-bit FNV-1a over 8-byte lanes (byte-wise for the tail): one multiply per 8 bytes
+inline uint64_t objectChecksum(const void* bytes, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    const uint64_t prime = 1099511628211ULL;
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    size_t lanes = size / 8;
+    for (size_t i = 0; i < lanes; ++i, p += 8) {
+        uint64_t lane;
+        memcpy(&lane, p, 8);
+        hash = (hash ^ lane) * prime;
+    }
+    for (size_t i = lanes * 8; i < size; ++i, ++p) {
+        hash = (hash ^ *p) * prime;
+    }
+    return hash;
+}
+
+inline uint64_t alignObjectOffset(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+inline bool writeObjectImage(const std::string& path, const std::vector<int>& code, const std::vector<Word>& data,
+                             uint64_t dataAddress) {
+    ObjectHeader header = {};
+    memcpy(header.magic, OBJECT_MAGIC, sizeof(header.magic));
+    header.version = OBJECT_VERSION;
+    header.headerSize = sizeof(ObjectHeader);
+    header.codeOffset = alignObjectOffset(sizeof(ObjectHeader));
+    header.codeWords = code.size();
+    header.dataOffset = alignObjectOffset(header.codeOffset + code.size() * sizeof(int));
+    header.dataSize = data.size();
+    header.dataAddress = dataAddress;
+    header.checksum = objectChecksum(data.data(), data.size(), objectChecksum(code.data(), code.size() * sizeof(int)));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    static const char padding[8] = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding, header.codeOffset - sizeof(header));
+    file.write(reinterpret_cast<const char*>(code.data()), code.size() * sizeof(int));
+    file.write(padding, header.dataOffset - (header.codeOffset + code.size() * sizeof(int)));
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return file.good();
+}
+
+// A mapped object image; code() and data() point into the mapping
+class ObjectImage {
+public:
+    bool open(const std::string& path, std::string& error) {
+        if (!file.open(path)) {
+            error = "unable to open " + path;
+            return false;
+        }
+        std::string_view bytes = file.view();
+        if (bytes.size() < sizeof(ObjectHeader)) {
+            error = path + " is too small to be an object image";
+            return false;
+        }
+        memcpy(&header, bytes.data(), sizeof(header));
+        if (memcmp(header.magic, OBJECT_MAGIC, sizeof(header.magic)) != 0 || header.version != OBJECT_VERSION ||
+            header.headerSize != sizeof(ObjectHeader)) {
+            error = path + " is not a vCPU object image";
+            return false;
+        }
+        if (header.codeOffset % 8 != 0 || header.dataOffset % 8 != 0 || header.codeOffset > bytes.size() ||
+            header.codeWords > (bytes.size() - header.codeOffset) / sizeof(int) || header.dataOffset > bytes.size() ||
+            header.dataSize > bytes.size() - header.dataOffset) {
+            error = path + " is truncated";
+            return false;
+        }
+        codeWords = reinterpret_cast<const int*>(bytes.data() + header.codeOffset);
+        dataBytes = reinterpret_cast<const Word*>(bytes.data() + header.dataOffset);
+        uint64_t checksum = objectChecksum(dataBytes, header.dataSize, objectChecksum(codeWords, header.codeWords * sizeof(int)));
+        if (checksum != header.checksum) {
+            error = path + " failed its checksum";
+            return false;
+        }
+        return true;
+    }
+
+    const int* code() const { return codeWords; }
+    size_t codeSize() const { return header.codeWords; }
+    const Word* data() const { return dataBytes; }
+    size_t dataSize() const { return header.dataSize; }
+    uint64_t dataAddress() const { return header.dataAddress; }
+
+private:
+    MappedFile file;
+    ObjectHeader header = {};
+    const int* codeWords = nullptr;
+    const Word* dataBytes = nullptr;
+};
+
+#endif
@@ -0,0 +1,198 @@
+// Timing model of a Tomasulo-style out-of-order core, fed the retired instruction stream.
+// The functional result still comes from the CPU; the model only works out when each
+// instruction would dispatch, execute, complete and commit.
+//
+// - Up to `width` instructions dispatch per cycle, in order, each into a reorder buffer
+//   entry and a reservation station. Dispatch waits while either is full.
+// - Registers are renamed, so an instruction waits only for the producers of its source
+//   registers (true dependences); a LOAD or RET also waits for the last STORE or CALL to
+//   the same address, whose value it gets forwarded.
+// - Up to `width` instructions start executing per cycle, oldest first. Execution frees
+//   the reservation station; the result is available `latency` cycles later.
+// - Instructions commit in order, up to `width` per cycle, the cycle after they complete.
+//   INPUT and OUTPUT do not execute speculatively: they wait until everything older
+//   has committed.
+// - The front end predicts JUMP/CALL/RET targets with the `ras` branch predictor. After
+//   a misprediction, dispatch resumes the cycle after the transfer executes.
+#ifndef VCPU_OUT_OF_ORDER_MODEL_H
+#define VCPU_OUT_OF_ORDER_MODEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "BranchPredictor.h"
+#include "Machine.h"
+
+struct OutOfOrderConfig {
+    int width = 4;
+    int reorderBuffer = 64;
+    int reservationStations = 32;
+};
+
+class OutOfOrderModel {
+public:
+    static const size_t NO_ADDRESS = SIZE_MAX;
+
+    explicit OutOfOrderModel(const OutOfOrderConfig& config)
+        : config(config), predictor(PREDICT_RAS), dispatched(config.width, 0), committed(config.width, 0),
+          reorderBuffer(config.reorderBuffer, 0), issueSlots(ISSUE_WINDOW) {
+        std::fill(ready, ready + REGISTER_COUNT, 0);
+    }
+
+    // Times one instruction. next is the address that actually executed after it, and
+    // address the memory cell it reads or writes (NO_ADDRESS for none).
+    void issue(int pc, const DecodedInstruction& instruction, int next, size_t address) {
+        InstructionType type = instruction.type;
+        size_t slot = instructions % config.width;
+
+        // Dispatch: in order, width per cycle, then each structural limit in turn
+        uint64_t dispatch = std::max(lastDispatch, dispatched[slot] + 1);
+        dispatch = delay(dispatch, redirect, stalls[STALL_MISPREDICT]);
+        dispatch = delay(dispatch, reorderBuffer[instructions % config.reorderBuffer] + 1, stalls[STALL_REORDER_BUFFER]);
+        while (!stations.empty() && stations.top() <= dispatch) stations.pop();
+        if (stations.size() >= static_cast<size_t>(config.reservationStations)) {
+            dispatch = delay(dispatch, stations.top(), stalls[STALL_RESERVATION_STATIONS]);
+            stations.pop();
+        }
+
+        // Execute once the operands are ready and an issue slot is free
+        uint64_t operands = dispatch + 1;
+        auto need = [&](int reg) { operands = std::max(operands, ready[reg]); };
+        if (type == ADD || type == SUB) {
+            need(instruction.reg1);
+            need(instruction.reg2);
+        } else if (type == LOAD || type == JUMP || type == CALL) {
+            need(instruction.reg2);
+        } else if (type == STORE) {
+            need(instruction.reg1);
+            need(instruction.reg2);
+        } else if (type == OUTPUT) {
+            need(instruction.reg1);
+        }
+        if ((type == LOAD || type == RET) && address != NO_ADDRESS) {
+            auto store = memoryReady.find(address);
+            if (store != memoryReady.end()) operands = std::max(operands, store->second);
+        }
+        if (type == INPUT || type == OUTPUT) {
+            uint64_t older = lastCommit + 1;
+            serializeCycles += older > operands ? older - operands : 0;
+            operands = std::max(operands, older);
+        }
+        operandWait += operands - (dispatch + 1);
+        uint64_t start = claimIssueSlot(operands);
+        stations.push(start);
+        uint64_t complete = start + latency(type);
+
+        if (type == ADD || type == SUB || type == LOAD || type == INPUT || type == UNKNOWN) {
+            ready[instruction.reg1] = complete;
+        }
+        if ((type == STORE || type == CALL) && address != NO_ADDRESS) {
+            memoryReady[address] = complete;
+        }
+
+        // Commit in order, width per cycle
+        uint64_t commit = std::max({complete + 1, lastCommit, committed[slot] + 1});
+
+        if (type == JUMP || type == CALL || type == RET) {
+            ++transfers;
+            if (predictor.predict(pc, type) != next) {
+                ++mispredictions;
+                redirect = complete + 1;
+            }
+            predictor.update(pc, type, next);
+        }
+
+        dispatched[slot] = dispatch;
+        committed[slot] = commit;
+        reorderBuffer[instructions % config.reorderBuffer] = commit;
+        lastDispatch = dispatch;
+        lastCommit = commit;
+        ++instructions;
+    }
+
+    uint64_t cycles() const { return lastCommit; }
+
+    void report(std::ostream& out) const {
+        static const char* const causes[STALL_CAUSES] = {"branch mispredictions", "reorder buffer full",
+                                                         "reservation stations full"};
+        out << "Out-of-order model (" << config.width << "-wide, " << config.reorderBuffer << "-entry ROB, "
+            << config.reservationStations << " reservation stations): " << instructions << " instructions in "
+            << cycles() << " cycles, IPC " << std::fixed << std::setprecision(3)
+            << (cycles() == 0 ? 0.0 : static_cast<double>(instructions) / cycles()) << std::endl;
+        out << "  Average wait for operands: " << (instructions == 0 ? 0.0 : static_cast<double>(operandWait) / instructions)
+            << " cycles" << std::endl;
+        out.unsetf(std::ios::floatfield);
+        int dominant = 0;
+        for (int cause = 0; cause < STALL_CAUSES; ++cause) {
+            if (stalls[cause] > stalls[dominant]) dominant = cause;
+        }
+        out << "  Dispatch stall cycles:";
+        for (int cause = 0; cause < STALL_CAUSES; ++cause) {
+            out << (cause == 0 ? " " : ", ") << stalls[cause] << ' ' << causes[cause];
+        }
+        out << std::endl;
+        if (stalls[dominant] > 0) {
+            out << "  Dominant stall: " << causes[dominant] << std::endl;
+        }
+        out << "  Mispredicted " << mispredictions << " of " << transfers << " transfers; INPUT/OUTPUT waited "
+            << serializeCycles << " cycles for older instructions to commit" << std::endl;
+    }
+
+private:
+    enum StallCause { STALL_MISPREDICT, STALL_REORDER_BUFFER, STALL_RESERVATION_STATIONS, STALL_CAUSES };
+    static const size_t ISSUE_WINDOW = 4096;  // cycles of issue-slot bookkeeping kept
+
+    static uint64_t delay(uint64_t cycle, uint64_t earliest, uint64_t& stallCycles) {
+        if (earliest <= cycle) return cycle;
+        stallCycles += earliest - cycle;
+        return earliest;
+    }
+
+    static int latency(InstructionType type) {
+        return type == LOAD || type == RET ? 2 : 1;
+    }
+
+    // First cycle from `cycle` on with an issue slot left
+    uint64_t claimIssueSlot(uint64_t cycle) {
+        for (;; ++cycle) {
+            IssueSlot& slot = issueSlots[cycle % ISSUE_WINDOW];
+            if (slot.cycle != cycle) slot = {cycle, 0};
+            if (slot.used < config.width) {
+                ++slot.used;
+                return cycle;
+            }
+        }
+    }
+
+    struct IssueSlot {
+        uint64_t cycle = UINT64_MAX;
+        int used = 0;
+    };
+
+    OutOfOrderConfig config;
+    BranchPredictor predictor;
+    std::vector<uint64_t> dispatched;    // dispatch cycle of the last `width` instructions
+    std::vector<uint64_t> committed;     // commit cycle of the last `width` instructions
+    std::vector<uint64_t> reorderBuffer; // commit cycle of the instruction holding each entry
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> stations;  // release cycles
+    std::vector<IssueSlot> issueSlots;
+    std::unordered_map<size_t, uint64_t> memoryReady;  // completion of the last store to each address
+    uint64_t ready[REGISTER_COUNT];      // cycle each register's latest value is available
+    uint64_t lastDispatch = 0;
+    uint64_t lastCommit = 0;
+    uint64_t redirect = 0;
+    uint64_t instructions = 0;
+    uint64_t transfers = 0;
+    uint64_t mispredictions = 0;
+    uint64_t operandWait = 0;
+    uint64_t serializeCycles = 0;
+    uint64_t stalls[STALL_CAUSES] = {};
+};
+
+#endif
@@ -0,0 +1,63 @@
+// Bounded output sink for the execution trace. Text goes into a fixed-size buffer
+// that is drained to the output file (and optionally teed to another stream, e.g. the
+// console) whenever it fills up or the stream is flushed. The producer waits while a
+// full buffer drains, so a long-running program cannot grow memory without bound.
+#ifndef VCPU_OUTPUT_SINK_H
+#define VCPU_OUTPUT_SINK_H
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+class OutputSink : public std::streambuf {
+public:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    OutputSink(const std::string& path, std::ostream* teeStream, size_t capacity = DEFAULT_CAPACITY)
+        : file(path, std::ios::binary | std::ios::trunc), tee(teeStream), buffer(capacity) {
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    ~OutputSink() override { sync(); }
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    bool isOpen() const { return file.is_open(); }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (!drain()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override { return drain() ? 0 : -1; }
+
+private:
+    bool drain() {
+        std::streamsize pending = pptr() - pbase();
+        if (pending > 0) {
+            file.write(pbase(), pending);
+            file.flush();
+            if (tee != nullptr) {
+                tee->write(pbase(), pending);
+                tee->flush();
+            }
+        }
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return file.good();
+    }
+
+    std::ofstream file;
+    std::ostream* tee;
+    std::vector<char> buffer;
+};
+
+#endif
@@ -0,0 +1,68 @@
+// Parallel front end for the single-pass assembler. The source is cut into one chunk
+// per thread at '\n' boundaries. Each thread first counts its lines; a prefix sum over
+// the counts gives every chunk its first output index, and then each thread encodes its
+// lines straight into the shared machine-code vector. The result is identical to
+// assemble() because lines are encoded independently.
+#ifndef VCPU_PARALLEL_ASSEMBLER_H
+#define VCPU_PARALLEL_ASSEMBLER_H
+
+#include <algorithm>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Assembler.h"
+
+// Sources smaller than this are assembled serially; thread start-up would dominate
+const size_t PARALLEL_ASSEMBLER_MIN_CHUNK = 1 << 20;
+
+// Runs job(index) for index in [0, count) with one thread per index
+template <class Job>
+void runOnThreads(size_t count, Job job) {
+    std::vector<std::thread> workers;
+    workers.reserve(count - 1);
+    for (size_t i = 1; i < count; ++i) {
+        workers.emplace_back(job, i);
+    }
+    job(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// threads == 0 uses every hardware thread
+inline std::vector<int> assembleParallel(std::string_view source, unsigned threads = 0) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t chunkCount = std::min<size_t>(threads, source.size() / PARALLEL_ASSEMBLER_MIN_CHUNK);
+    if (chunkCount <= 1) {
+        return assemble(source);
+    }
+
+    // Chunk boundaries, each moved forward to just past the next '\n'
+    std::vector<size_t> bounds(chunkCount + 1, source.size());
+    bounds[0] = 0;
+    for (size_t i = 1; i < chunkCount; ++i) {
+        size_t newline = source.find('\n', std::max(bounds[i - 1], source.size() / chunkCount * i));
+        bounds[i] = newline == std::string_view::npos ? source.size() : newline + 1;
+    }
+
+    std::vector<size_t> firstLine(chunkCount + 1, 0);
+    runOnThreads(chunkCount, [&](size_t chunk) {
+        firstLine[chunk + 1] = countLines(source.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]));
+    });
+    for (size_t i = 0; i < chunkCount; ++i) {
+        firstLine[i + 1] += firstLine[i];
+    }
+
+    std::vector<int> machineCode(firstLine[chunkCount]);
+    runOnThreads(chunkCount, [&](size_t chunk) {
+        int* out = machineCode.data() + firstLine[chunk];
+        forEachLine(source.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]),
+                    [&](const char* begin, const char* end) { *out++ = encodeLine(begin, end); });
+    });
+    return machineCode;
+}
+
+#endif
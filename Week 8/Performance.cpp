@@ -4,86 +4,180 @@
 #include <map>
 #include <vector>
 #include <string>
-#include <bitset>
 #include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+#include "Machine.h"
+#include "Trace.h"
+#include "DeltaTrace.h"
+#include "BinaryTrace.h"
+#include "ModelTrace.h"
+#include "PerformanceCounters.h"
+#include "OutputSink.h"
+#include "Assembler.h"
+#include "MappedFile.h"
+#include "ObjectImage.h"
+#include "IncrementalAssembler.h"
+#include "ParallelAssembler.h"
+#include "Jit.h"
+#include "WorkStealingPool.h"
+#include "Lockstep.h"
 
 using namespace std;
 using namespace std::chrono;
 
-enum InstructionType { ADD, SUB, LOAD, STORE, INPUT, OUTPUT, JUMP, CALL, RET, UNKNOWN };
-
-// Helper function for binary to decimal conversion
-int binaryToDecimal(const string& binary) {
-    return stoi(binary, nullptr, 2);
-}
-
-// Helper function for decimal to binary conversion
-string decimalToBinary(int decimal) {
-    return bitset<8>(decimal).to_string();
-}
-
 // ALU class
 class ALU {
 public:
-    string performOperation(const string& opcode, const string& operand1, const string& operand2) {
-        int op1 = binaryToDecimal(operand1);
-        int op2 = binaryToDecimal(operand2);
-        int result;
-        if (opcode == "ADD") result = op1 + op2;
-        else if (opcode == "SUB") result = op1 - op2;
-        else if (opcode == "LOAD") result = op2;
-        else if (opcode == "STORE") result = op1;
-        else result = 0;
-        return decimalToBinary(result);
+    Word performOperation(InstructionType opcode, Word operand1, Word operand2) {
+        switch (opcode) {
+            case ADD: return operand1 + operand2;
+            case SUB: return operand1 - operand2;
+            case LOAD: return operand2;
+            case STORE: return operand1;
+            default: return 0;
+        }
     }
 };
 
-// General-purpose registers class
-class Registers {
-public:
-    map<string, string> regs;
-    Registers() {
-        regs["R0"] = decimalToBinary(0);
-        regs["R1"] = decimalToBinary(4);
-        regs["R2"] = decimalToBinary(9);
-        regs["R3"] = decimalToBinary(10);
+// Parses a whole non-negative decimal number that fits in value's type
+template <class Number>
+bool parseNumber(const string& text, Number& value) {
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) return false;
+    size_t end = 0;
+    unsigned long long number;
+    try {
+        number = stoull(text, &end);
+    } catch (const exception&) {
+        return false;
     }
-    string get(const string& reg) { return regs[reg]; }
-    void set(const string& reg, const string& value) { regs[reg] = value; }
-    void display(ostream& outputStream) {
-        for (const auto& reg : regs) {
-            outputStream << reg.first << ": " << binaryToDecimal(reg.second) << " ";
-        }
-        outputStream << endl;
+    if (end != text.size() || number > static_cast<unsigned long long>(numeric_limits<Number>::max())) return false;
+    value = static_cast<Number>(number);
+    return true;
+}
+
+// Parses a memory size such as "25", "64K", "16M" or "4G" (binary multiples), from one
+// cell up to MAX_MEMORY_SIZE
+bool parseMemorySize(const string& text, size_t& size) {
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) return false;
+    size_t end = 0;
+    unsigned long long value;
+    try {
+        value = stoull(text, &end);
+    } catch (const exception&) {
+        return false;
     }
+    string suffix = text.substr(end);
+    int shift = 0;
+    if (suffix == "K" || suffix == "KB") shift = 10;
+    else if (suffix == "M" || suffix == "MB") shift = 20;
+    else if (suffix == "G" || suffix == "GB") shift = 30;
+    else if (!suffix.empty()) return false;
+    if (value > (numeric_limits<size_t>::max() >> shift)) return false;
+    size = static_cast<size_t>(value) << shift;
+    return size > 0 && size <= MAX_MEMORY_SIZE;
+}
+
+// Trace levels: nothing, one line per instruction, the full fetch/decode/state dump,
+// only the registers and memory cells each instruction wrote (DeltaTrace.h), or
+// fixed-size binary records streamed to a file (BinaryTrace.h)
+enum TraceLevel { TRACE_OFF, TRACE_SUMMARY, TRACE_FULL, TRACE_DELTA, TRACE_BINARY };
+
+// Highest trace level compiled into the engines (0 = off, 1 = summary, delta and binary, 2 = full).
+// Lower levels are always available; asking for a higher one at run time falls back.
+#ifndef VCPU_MAX_TRACE_LEVEL
+#define VCPU_MAX_TRACE_LEVEL 2
+#endif
+
+// Execution engines selectable at runtime
+enum EngineType { SWITCH_ENGINE, THREADED_ENGINE, BLOCK_ENGINE, FUSED_ENGINE, JIT_ENGINE };
+
+const char* engineName(EngineType engine) {
+    static const char* const names[] = {"switch", "threaded", "block", "fused", "jit"};
+    return names[engine];
+}
+
+// Direct-threaded dispatch needs the labels-as-values extension; define
+// VCPU_NO_COMPUTED_GOTO to force the portable switch fallback
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VCPU_NO_COMPUTED_GOTO)
+#define VCPU_COMPUTED_GOTO 1
+#endif
+
+// A program ready to load: machine words plus initial data for guest memory.
+// The pointers may refer into a mapped object image.
+struct ProgramImage {
+    const int* code = nullptr;
+    size_t codeSize = 0;
+    const Word* data = nullptr;
+    size_t dataSize = 0;
+    uint64_t dataAddress = 0;
 };
 
-// Memory management class
-class Memory {
-public:
-    vector<string> memorySpace;
-    Memory(int size) : memorySpace(size, decimalToBinary(0)) {}
-    string read(int address) {
-        if (address < 0 || address >= memorySpace.size()) {
-            cout << "Memory read error: Address out of bounds" << endl;
-            return decimalToBinary(-1);
-        }
-        return memorySpace[address];
-    }
-    void write(int address, const string& value) {
-        if (address < 0 || address >= memorySpace.size()) {
-            cout << "Memory write error: Address out of bounds" << endl;
-            return;
-        }
-        cout << "Writing value " << binaryToDecimal(value) << " to memory address " << address << endl;
-        memorySpace[address] = value;
-    }
-    void display(ostream& outputStream) {
-        for (int i = 0; i < memorySpace.size(); ++i) {
-            outputStream << "Address " << i << ": " << binaryToDecimal(memorySpace[i]) << " ";
-        }
-        outputStream << endl;
-    }
+// Machine state captured by CPU::snapshot(). Memory pages are shared with the CPU and
+// copied only when one side writes to them, so taking and restoring a snapshot costs
+// one pointer per page table (2 MiB of memory). The program itself is not included; guest code cannot modify it.
+struct CPUSnapshot {
+    int programCounter = 0;
+    Registers registers;
+    Memory::Snapshot memory;
+    uint64_t instructionsRetired = 0;
+};
+
+// Handler kinds of the block engine: one per InstructionType, then the marker for a
+// block that ends without a control transfer, then the superinstructions
+enum BlockOpKind : uint8_t {
+    BLOCK_END = UNKNOWN + 1,
+    FUSED_LOAD_ADD_STORE,
+    FUSED_LOAD_ADD,
+    FUSED_ADD_STORE,
+    FUSED_SUB_JUMP,
+    BLOCK_OP_KINDS
+};
+
+const int FIRST_SUPERINSTRUCTION = FUSED_LOAD_ADD_STORE;
+
+// Adjacent instruction sequences the fused engine runs through one handler, in
+// BlockOpKind order; fusion tries them in this order, so longer sequences come first
+struct Superinstruction {
+    BlockOpKind kind;
+    const char* name;
+    int length;
+    InstructionType sequence[3];
+};
+
+const Superinstruction SUPERINSTRUCTIONS[] = {
+    {FUSED_LOAD_ADD_STORE, "LOAD+ADD+STORE", 3, {LOAD, ADD, STORE}},
+    {FUSED_LOAD_ADD, "LOAD+ADD", 2, {LOAD, ADD}},
+    {FUSED_ADD_STORE, "ADD+STORE", 2, {ADD, STORE}},
+    {FUSED_SUB_JUMP, "SUB+JUMP", 2, {SUB, JUMP}},
+};
+const int SUPERINSTRUCTION_COUNT = sizeof(SUPERINSTRUCTIONS) / sizeof(SUPERINSTRUCTIONS[0]);
+
+// One instruction of a translated block: its handler address with the decoded operands
+// bound to it. A superinstruction's handler sits on its first op and consumes the
+// following ops' operands, which keep their own instructions.
+struct BlockOp {
+    const void* handler;
+    DecodedInstruction instruction;
+    uint8_t kind;
+};
+
+// A straight-line run of instructions ending after a JUMP/CALL/RET or at the end of the
+// program. Blocks may overlap when a jump lands inside an already translated block.
+struct TranslatedBlock {
+    int start;        // first instruction address; -1 once invalidated
+    int length;
+    size_t firstOp;   // index into CPU::blockOps
+    int successorPc;  // last target this block transferred to, and the block found there
+    int successor;
 };
 
 // CPU class
@@ -91,102 +185,669 @@ class CPU {
 public:
     int programCounter;
     vector<int> instructionMemory;
+    vector<DecodedInstruction> decodedProgram;
     Registers registers;
     ALU alu;
     Memory memory;
+    EngineType engine;
+    TraceLevel traceLevel;
+    string binaryTracePath;  // where TRACE_BINARY streams its records
+    uint64_t instructionsRetired;
+    uint64_t instructionLimit;  // checked at JUMP/CALL/RET, so straight-line code always runs to the end
+    uint64_t lastRunNanoseconds;
+    EngineType lastRunEngine;  // the engine that ran last; traced JIT runs use the block engine
+    uint64_t superinstructionsExecuted[SUPERINSTRUCTION_COUNT];  // per SUPERINSTRUCTIONS entry, fused engine only
+    uint64_t blocksDropped;     // translated blocks invalidated by writeInstruction
+    uint64_t blockCompactions;  // times the dropped blocks' ops were reclaimed
+    istream* input;    // INPUT reads from here
+    ostream* console;  // OUTPUT, prompts, errors and the run summary go here
+    Models models;     // attached models; a run with any of them feeds them instead of tracing
+    PerformanceCounters counters;
 
-    CPU() : programCounter(0), memory(25) {} // Initialize with memory size 25
+    explicit CPU(size_t memorySize = DEFAULT_MEMORY_SIZE)
+        : programCounter(0), memory(memorySize), engine(SWITCH_ENGINE), traceLevel(TRACE_FULL),
+          binaryTracePath("trace.bin"), instructionsRetired(0), instructionLimit(UINT64_MAX), lastRunNanoseconds(0),
+          lastRunEngine(SWITCH_ENGINE), superinstructionsExecuted{}, blocksDropped(0), blockCompactions(0), input(&cin),
+          console(&cout) {}
+
+    // Gives this CPU its own console, e.g. one per job in a batch
+    void setConsole(istream& inputStream, ostream& consoleStream) {
+        input = &inputStream;
+        console = &consoleStream;
+        memory.diagnostics = &consoleStream;
+    }
     void loadProgram(const vector<int>& program) {
-        instructionMemory = program;
+        loadProgram(program.data(), program.size());
+    }
+    void loadProgram(const int* program, size_t size) {
+        instructionMemory.assign(program, program + size);
+        decodedProgram.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            decodedProgram[i] = decodeInstruction(program[i]);
+        }
+        flushBlocks();
+        flushJit();
+    }
+    // Replaces one instruction and drops every translated block that contains it. Once the
+    // dropped blocks hold more ops than the live ones, the cache is compacted.
+    bool writeInstruction(size_t address, int instruction) {
+        if (address >= instructionMemory.size()) {
+            *console << "Instruction write error: Address out of bounds" << endl;
+            return false;
+        }
+        instructionMemory[address] = instruction;
+        decodedProgram[address] = decodeInstruction(instruction);
+        for (size_t index = 0; index < blocks.size(); ++index) {
+            TranslatedBlock& block = blocks[index];
+            if (block.start >= 0 && address >= static_cast<size_t>(block.start) &&
+                address < static_cast<size_t>(block.start + block.length)) {
+                blockAt[block.start] = -1;
+                block.start = -1;
+                deadBlockOps += blockOpsEnd(index) - block.firstOp;
+                blocksDropped++;
+            }
+        }
+        if (deadBlockOps > blockOps.size() / 2) {
+            compactBlocks();
+            blockCompactions++;
+        }
+        flushJit();
+        return true;
+    }
+    // Copies initial data into guest memory; false if it does not fit
+    bool loadData(uint64_t address, const Word* data, size_t size) {
+        if (address > memory.size() || size > memory.size() - address) {
+            return false;
+        }
+        memory.writeBlock(address, data, size);
+        return true;
+    }
+    bool loadImage(const ProgramImage& image) {
+        loadProgram(image.code, image.codeSize);
+        return loadData(image.dataAddress, image.data, image.dataSize);
+    }
+    CPUSnapshot snapshot() const {
+        return {programCounter, registers, memory.snapshot(), instructionsRetired};
+    }
+    // Returns to a snapshot taken from a CPU running the same program
+    void restore(const CPUSnapshot& snapshot) {
+        programCounter = snapshot.programCounter;
+        registers = snapshot.registers;
+        memory.restore(snapshot.memory);
+        instructionsRetired = snapshot.instructionsRetired;
     }
     void executeProgram(ostream& outputStream) {
+        uint64_t retiredBefore = instructionsRetired;
+        uint64_t badReadsBefore = memory.readsOutOfBounds();
+        uint64_t badWritesBefore = memory.writesOutOfBounds();
+        lastRunEngine = engine;
         auto start = high_resolution_clock::now();
-        while (programCounter < instructionMemory.size()) {
-            int instruction = instructionMemory[programCounter];
-            outputStream << "Fetching instruction at address " << programCounter << ": " << instruction << endl;
-            programCounter++;
-            decodeAndExecute(instruction, outputStream);
+        TraceLevel level = traceLevel;
+#if VCPU_MAX_TRACE_LEVEL < 2
+        if (level == TRACE_FULL) level = TRACE_SUMMARY;
+#endif
+#if VCPU_MAX_TRACE_LEVEL < 1
+        level = TRACE_OFF;
+#endif
+        if (models.any()) {
+            // Models take the place of the text trace
+            TraceModels trace(models, memory);
+            run(trace);
+        } else {
+            switch (level) {
+#if VCPU_MAX_TRACE_LEVEL >= 2
+                case TRACE_FULL: {
+                    TraceFull trace(outputStream, *console);
+                    run(trace);
+                    break;
+                }
+#endif
+#if VCPU_MAX_TRACE_LEVEL >= 1
+                case TRACE_SUMMARY: {
+                    TraceSummary trace(outputStream);
+                    run(trace);
+                    break;
+                }
+                case TRACE_DELTA: {
+                    TraceDelta trace(outputStream, registers, memory);
+                    run(trace);
+                    break;
+                }
+                case TRACE_BINARY: {
+                    TraceBinary trace(binaryTracePath, registers, memory);
+                    if (!trace.isOpen()) {
+                        *console << "Unable to open " << binaryTracePath << endl;
+                        return;
+                    }
+                    run(trace);
+                    break;
+                }
+#endif
+                default: {
+                    TraceOff trace;
+                    run(trace);
+                    break;
+                }
+            }
         }
         auto end = high_resolution_clock::now();
+        lastRunNanoseconds = duration_cast<nanoseconds>(end - start).count();
+        counters.hostNanoseconds += lastRunNanoseconds;
+        counters.runs++;
+        // Only LOAD and STORE can leave memory; CALL and RET use the last cell
+        counters.loadsOutOfBounds += memory.readsOutOfBounds() - badReadsBefore;
+        counters.storesOutOfBounds += memory.writesOutOfBounds() - badWritesBefore;
         auto duration = duration_cast<milliseconds>(end - start);
-        cout << "Program execution time: " << duration.count() << " ms" << endl;
+        *console << "Program execution time: " << duration.count() << " ms" << endl;
+        *console << "Executed " << instructionsRetired - retiredBefore << " instructions on the " << engineName(lastRunEngine)
+             << " engine (" << mips(instructionsRetired - retiredBefore, lastRunNanoseconds) << " MIPS)" << endl;
+    }
+
+    // Which superinstructions fired and how many dispatches they saved
+    void printFusionReport(ostream& outputStream) const {
+        uint64_t saved = 0;
+        outputStream << "Superinstructions executed:" << endl;
+        for (int i = 0; i < SUPERINSTRUCTION_COUNT; ++i) {
+            outputStream << "  " << SUPERINSTRUCTIONS[i].name << ": " << superinstructionsExecuted[i] << endl;
+            saved += superinstructionsExecuted[i] * (SUPERINSTRUCTIONS[i].length - 1);
+        }
+        uint64_t dispatches = instructionsRetired - saved;
+        outputStream << "Dispatches: " << dispatches << " for " << instructionsRetired << " instructions ("
+                     << (instructionsRetired == 0 ? 0.0 : saved * 100.0 / instructionsRetired) << "% fewer)" << endl;
+    }
+
+    static double mips(uint64_t instructions, uint64_t nanoseconds) {
+        return nanoseconds == 0 ? 0.0 : instructions * 1000.0 / nanoseconds;
     }
 
 private:
-    void decodeAndExecute(int instruction, ostream& outputStream) {
-        int opcode = (instruction >> 6) & 0x03;
-        int reg1 = (instruction >> 3) & 0x07;
-        int reg2 = instruction & 0x07;
-        string opcodeStr = getOpcodeString(opcode);
-
-        outputStream << "Decoding instruction: " << instruction << " as (" << opcodeStr << " R" << reg1 << " R" << reg2 << ")" << endl;
-
-        string operand1 = registers.get("R" + to_string(reg1));
-        string operand2 = registers.get("R" + to_string(reg2));
-
-        outputStream << "Operands: " << "operand1 = " << binaryToDecimal(operand1) << ", operand2 = " << binaryToDecimal(operand2) << endl;
-
-        if (opcodeStr == "INPUT") {
-            int value;
-            cout << "Enter value for R" << reg1 << ": ";
-            cin >> value;
-            registers.set("R" + to_string(reg1), decimalToBinary(value));
-            outputStream << "Input value " << value << " into R" << reg1 << endl;
-        } else if (opcodeStr == "OUTPUT") {
-            int value = binaryToDecimal(registers.get("R" + to_string(reg1)));
-            cout << "Output value from R" << reg1 << ": " << value << endl;
-            outputStream << "Output value from R" << reg1 << ": " << value << endl;
-        } else if (opcodeStr == "JUMP") {
-            programCounter = binaryToDecimal(operand2);
-            outputStream << "Jumping to address " << binaryToDecimal(operand2) << endl;
-        } else if (opcodeStr == "CALL") {
-            memory.write(memory.memorySpace.size() - 1, decimalToBinary(programCounter));
-            programCounter = binaryToDecimal(operand2);
-            outputStream << "Calling subroutine at address " << binaryToDecimal(operand2) << endl;
-        } else if (opcodeStr == "RET") {
-            programCounter = binaryToDecimal(memory.read(memory.memorySpace.size() - 1));
-            outputStream << "Returning from subroutine to address " << programCounter << endl;
+    // Basic-block translation cache used by the block engine. Handlers are specific to
+    // the trace policy they were translated for, so blockHandlerTable tells which one.
+    vector<TranslatedBlock> blocks;
+    vector<BlockOp> blockOps;
+    vector<int> blockAt;  // block starting at each address, or -1
+    const void* const* blockHandlerTable = nullptr;
+    bool blocksFused = false;
+    size_t deadBlockOps = 0;  // ops of invalidated blocks, reclaimed by compactBlocks
+
+    // Native code for hot blocks (JIT engine); blocks are translated once they have been
+    // entered JIT_HOT_THRESHOLD times and run interpreted until then
+    static const uint32_t JIT_HOT_THRESHOLD = 16;
+#ifdef VCPU_HAVE_JIT
+    unique_ptr<JitCompiler> jit;
+    vector<const void*> jitCode;  // native entry for each address, or nullptr
+    vector<uint32_t> jitHeat;     // block entries seen at each address
+    bool jitStores = false;       // some compiled block contains a STORE
+    bool jitCalls = false;        // some compiled block ends in a CALL
+#endif
+
+    template <class Trace>
+    void run(Trace& trace) {
+        if (engine == THREADED_ENGINE) {
+            runThreaded(trace);
+        } else if (engine == BLOCK_ENGINE || engine == FUSED_ENGINE) {
+            runBlocks(trace);
+        } else if (engine == JIT_ENGINE) {
+            runJit(trace);
         } else {
-            string result = alu.performOperation(opcodeStr, operand1, operand2);
-            if (opcodeStr == "LOAD") {
-                string value = memory.read(binaryToDecimal(operand2));
-                registers.set("R" + to_string(reg1), value);
-                outputStream << "Loaded value " <<binaryToDecimal(value)<<"into R"<<reg1<<endl;
-            } else if (opcodeStr == "STORE") {
-                memory.write(binaryToDecimal(operand2), operand1);
-                outputStream << "Stored value " << binaryToDecimal(operand1) << " at memory address " << binaryToDecimal(operand2) << endl;
+            runSwitch(trace);
+        }
+        trace.halt(programCounter);
+    }
+
+    // Reference engine: one switch per instruction
+    template <class Trace>
+    void runSwitch(Trace& trace) {
+        const int programSize = decodedProgram.size();
+        while (programCounter < programSize) {
+            const DecodedInstruction& instruction = decodedProgram[programCounter];
+            switch (instruction.type) {
+                case ADD: step<ADD>(instruction, trace); break;
+                case SUB: step<SUB>(instruction, trace); break;
+                case LOAD: step<LOAD>(instruction, trace); break;
+                case STORE: step<STORE>(instruction, trace); break;
+                case INPUT: step<INPUT>(instruction, trace); break;
+                case OUTPUT: step<OUTPUT>(instruction, trace); break;
+                case JUMP:
+                    step<JUMP>(instruction, trace);
+                    if (instructionsRetired >= instructionLimit) return;
+                    break;
+                case CALL:
+                    step<CALL>(instruction, trace);
+                    if (instructionsRetired >= instructionLimit) return;
+                    break;
+                case RET:
+                    step<RET>(instruction, trace);
+                    if (instructionsRetired >= instructionLimit) return;
+                    break;
+                default: step<UNKNOWN>(instruction, trace); break;
+            }
+        }
+    }
+
+    // Direct-threaded engine: each handler jumps straight to the next one. A halt
+    // sentinel after the last instruction ends straight-line code, so only control
+    // transfers (whose targets come from registers) need a bounds check.
+    template <class Trace>
+    void runThreaded(Trace& trace) {
+        const int programSize = decodedProgram.size();
+        const DecodedInstruction* program = decodedProgram.data();
+#ifdef VCPU_COMPUTED_GOTO
+        static void* const handlers[] = {&&op_ADD, &&op_SUB, &&op_LOAD, &&op_STORE, &&op_INPUT,
+                                         &&op_OUTPUT, &&op_JUMP, &&op_CALL, &&op_RET, &&op_UNKNOWN};
+        vector<void*> code(programSize + 1, &&op_halt);
+        for (int i = 0; i < programSize; ++i) {
+            code[i] = handlers[program[i].type];
+        }
+#define HANDLER(op) op_##op:
+#define DISPATCH() goto *code[programCounter]
+#else
+#define HANDLER(op) case op:
+#define DISPATCH() continue
+#endif
+#define DISPATCH_CHECKED()                                                                  \
+        if (programCounter >= programSize || instructionsRetired >= instructionLimit) goto op_halt; \
+        DISPATCH()
+
+#ifdef VCPU_COMPUTED_GOTO
+        if (programCounter >= programSize) goto op_halt;
+        DISPATCH();
+#else
+        while (programCounter < programSize) {
+            switch (program[programCounter].type) {
+#endif
+        HANDLER(ADD) step<ADD>(program[programCounter], trace); DISPATCH();
+        HANDLER(SUB) step<SUB>(program[programCounter], trace); DISPATCH();
+        HANDLER(LOAD) step<LOAD>(program[programCounter], trace); DISPATCH();
+        HANDLER(STORE) step<STORE>(program[programCounter], trace); DISPATCH();
+        HANDLER(INPUT) step<INPUT>(program[programCounter], trace); DISPATCH();
+        HANDLER(OUTPUT) step<OUTPUT>(program[programCounter], trace); DISPATCH();
+        HANDLER(JUMP) step<JUMP>(program[programCounter], trace); DISPATCH_CHECKED();
+        HANDLER(CALL) step<CALL>(program[programCounter], trace); DISPATCH_CHECKED();
+        HANDLER(RET) step<RET>(program[programCounter], trace); DISPATCH_CHECKED();
+        HANDLER(UNKNOWN) step<UNKNOWN>(program[programCounter], trace); DISPATCH();
+#ifndef VCPU_COMPUTED_GOTO
+            }
+        }
+#endif
+    op_halt:
+        return;
+#undef HANDLER
+#undef DISPATCH
+#undef DISPATCH_CHECKED
+    }
+
+    void flushBlocks() {
+        blocks.clear();
+        blockOps.clear();
+        blockAt.assign(decodedProgram.size(), -1);
+        deadBlockOps = 0;
+    }
+
+    // Blocks are appended with their ops, so a block's ops end where the next block's begin
+    size_t blockOpsEnd(size_t index) const {
+        return index + 1 < blocks.size() ? blocks[index + 1].firstOp : blockOps.size();
+    }
+
+    // Drops invalidated blocks and their ops and renumbers the rest. Successor links to a
+    // dropped block are cleared, so the next transfer looks the target up again.
+    void compactBlocks() {
+        vector<int> renumbered(blocks.size(), -1);
+        vector<TranslatedBlock> liveBlocks;
+        vector<BlockOp> liveOps;
+        liveOps.reserve(blockOps.size() - deadBlockOps);
+        for (size_t index = 0; index < blocks.size(); ++index) {
+            TranslatedBlock block = blocks[index];
+            if (block.start < 0) continue;
+            renumbered[index] = liveBlocks.size();
+            block.firstOp = liveOps.size();
+            liveOps.insert(liveOps.end(), blockOps.begin() + blocks[index].firstOp, blockOps.begin() + blockOpsEnd(index));
+            liveBlocks.push_back(block);
+        }
+        for (TranslatedBlock& block : liveBlocks) {
+            if (block.successor >= 0) block.successor = renumbered[block.successor];
+            if (block.successor < 0) block.successorPc = -1;
+        }
+        for (int& index : blockAt) {
+            if (index >= 0) index = renumbered[index];
+        }
+        blocks.swap(liveBlocks);
+        blockOps.swap(liveOps);
+        deadBlockOps = 0;
+    }
+
+    // Translates the block starting at pc and returns its index. Blocks that run off the
+    // end of the program get a BLOCK_END op so the engine can look up the next block.
+    int translateBlock(int pc) {
+        const int programSize = decodedProgram.size();
+        TranslatedBlock block = {pc, 0, blockOps.size(), -1, -1};
+        int i = pc;
+        for (; i < programSize; ++i) {
+            const DecodedInstruction& instruction = decodedProgram[i];
+            blockOps.push_back({blockHandlerTable[instruction.type], instruction, instruction.type});
+            if (instruction.type == JUMP || instruction.type == CALL || instruction.type == RET) {
+                break;
+            }
+        }
+        block.length = min(i + 1, programSize) - pc;
+        if (i == programSize) {
+            blockOps.push_back({blockHandlerTable[BLOCK_END], {UNKNOWN, 0, 0, 0}, BLOCK_END});
+        }
+        if (blocksFused) {
+            fuseBlock(block.firstOp, block.firstOp + block.length);
+        }
+        blocks.push_back(block);
+        blockAt[pc] = blocks.size() - 1;
+        return blocks.size() - 1;
+    }
+
+    // Replaces the first op of every matching sequence with its superinstruction. The
+    // sequences never cross a block, so state and trace output are the same as unfused.
+    void fuseBlock(size_t begin, size_t end) {
+        for (size_t i = begin; i < end;) {
+            int fused = 1;
+            for (const Superinstruction& super : SUPERINSTRUCTIONS) {
+                if (end - i < static_cast<size_t>(super.length)) continue;
+                int matched = 0;
+                while (matched < super.length && blockOps[i + matched].kind == super.sequence[matched]) ++matched;
+                if (matched == super.length) {
+                    blockOps[i].handler = blockHandlerTable[super.kind];
+                    blockOps[i].kind = super.kind;
+                    fused = super.length;
+                    break;
+                }
+            }
+            i += fused;
+        }
+    }
+
+    // Block engine: each basic block is translated once into a run of handler addresses
+    // with their operands bound, so straight-line code dispatches from op to op with no
+    // program counter bounds checks. Blocks end at control transfers, where the
+    // instruction limit is checked and the next block is found through the previous
+    // block's successor link before falling back to the address map.
+    template <class Trace>
+    void runBlocks(Trace& trace) {
+#ifdef VCPU_COMPUTED_GOTO
+        static const void* const handlers[] = {&&op_ADD, &&op_SUB, &&op_LOAD, &&op_STORE, &&op_INPUT, &&op_OUTPUT,
+                                               &&op_JUMP, &&op_CALL, &&op_RET, &&op_UNKNOWN, &&op_BLOCK_END,
+                                               &&op_FUSED_LOAD_ADD_STORE, &&op_FUSED_LOAD_ADD, &&op_FUSED_ADD_STORE,
+                                               &&op_FUSED_SUB_JUMP};
+        static_assert(sizeof(handlers) / sizeof(handlers[0]) == BLOCK_OP_KINDS, "one handler per block op kind");
+#define HANDLER(op) op_##op:
+#define NEXT_OP(count) op += count; goto *op->handler
+#else
+        static const void* handlers[BLOCK_OP_KINDS];  // only its address is used, to tag the cache
+#define HANDLER(op) case op:
+#define NEXT_OP(count) op += count; continue
+#endif
+#define END_BLOCK()                                        \
+        if (instructionsRetired >= instructionLimit) return; \
+        goto next_block
+
+        // Handler addresses belong to this instantiation, so a cache built for another trace
+        // policy (or with fusion set differently) is dropped
+        if (blockHandlerTable != handlers || blocksFused != (engine == FUSED_ENGINE)) {
+            flushBlocks();
+            blockHandlerTable = handlers;
+            blocksFused = engine == FUSED_ENGINE;
+        }
+        const int programSize = decodedProgram.size();
+        int current = -1;
+        const BlockOp* op;
+
+    next_block:
+        if (programCounter >= programSize) return;
+        {
+            int pc = programCounter;
+            int next;
+            if (current >= 0 && blocks[current].successorPc == pc && blocks[blocks[current].successor].start == pc) {
+                next = blocks[current].successor;
             } else {
-                registers.set("R" + to_string(reg1), result);
-                outputStream << "Executing instruction: " << instruction << " (" << opcodeStr << " R" << reg1 << " R" << reg2 << ")" << endl;
-                outputStream << "Updated R" << reg1 <<" to " << binaryToDecimal(result) << endl;
+                next = blockAt[pc] >= 0 ? blockAt[pc] : translateBlock(pc);
+                if (current >= 0) {
+                    blocks[current].successorPc = pc;
+                    blocks[current].successor = next;
+                }
+            }
+            current = next;
+            op = &blockOps[blocks[current].firstOp];
+        }
+#ifdef VCPU_COMPUTED_GOTO
+        goto *op->handler;
+#else
+        for (;;) {
+            switch (op->kind) {
+#endif
+        HANDLER(ADD) step<ADD>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(SUB) step<SUB>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(LOAD) step<LOAD>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(STORE) step<STORE>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(INPUT) step<INPUT>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(OUTPUT) step<OUTPUT>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(JUMP) step<JUMP>(op->instruction, trace); END_BLOCK();
+        HANDLER(CALL) step<CALL>(op->instruction, trace); END_BLOCK();
+        HANDLER(RET) step<RET>(op->instruction, trace); END_BLOCK();
+        HANDLER(UNKNOWN) step<UNKNOWN>(op->instruction, trace); NEXT_OP(1);
+        HANDLER(BLOCK_END) goto next_block;
+        HANDLER(FUSED_LOAD_ADD_STORE)
+            step<LOAD>(op[0].instruction, trace);
+            step<ADD>(op[1].instruction, trace);
+            step<STORE>(op[2].instruction, trace);
+            superinstructionsExecuted[FUSED_LOAD_ADD_STORE - FIRST_SUPERINSTRUCTION]++;
+            NEXT_OP(3);
+        HANDLER(FUSED_LOAD_ADD)
+            step<LOAD>(op[0].instruction, trace);
+            step<ADD>(op[1].instruction, trace);
+            superinstructionsExecuted[FUSED_LOAD_ADD - FIRST_SUPERINSTRUCTION]++;
+            NEXT_OP(2);
+        HANDLER(FUSED_ADD_STORE)
+            step<ADD>(op[0].instruction, trace);
+            step<STORE>(op[1].instruction, trace);
+            superinstructionsExecuted[FUSED_ADD_STORE - FIRST_SUPERINSTRUCTION]++;
+            NEXT_OP(2);
+        HANDLER(FUSED_SUB_JUMP)
+            step<SUB>(op[0].instruction, trace);
+            step<JUMP>(op[1].instruction, trace);
+            superinstructionsExecuted[FUSED_SUB_JUMP - FIRST_SUPERINSTRUCTION]++;
+            END_BLOCK();
+#ifndef VCPU_COMPUTED_GOTO
             }
         }
+#endif
+#undef HANDLER
+#undef NEXT_OP
+#undef END_BLOCK
+    }
+
+    void flushJit() {
+#ifdef VCPU_HAVE_JIT
+        if (jit) {
+            jit->reset();
+        }
+        jitCode.assign(decodedProgram.size(), nullptr);
+        jitHeat.assign(decodedProgram.size(), 0);
+        jitStores = jitCalls = false;
+#endif
+    }
 
-        outputStream << "Current Register States: ";
-        registers.display(outputStream);
-        outputStream << "Current Memory State: ";
-        memory.display(outputStream);
-        outputStream << endl;
+#ifdef VCPU_HAVE_JIT
+    // Records whether the block compiled at pc writes memory through STORE or CALL
+    void noteJitWrites(int pc) {
+        for (size_t i = pc; i < decodedProgram.size(); ++i) {
+            InstructionType type = decodedProgram[i].type;
+            jitStores = jitStores || type == STORE;
+            jitCalls = jitCalls || type == CALL;
+            if (type == JUMP || type == CALL || type == RET) break;
+        }
     }
+#endif
 
-    string getOpcodeString(int opcode) {
-        switch (opcode) {
-            case 0: return "ADD";
-            case 1: return "SUB";
-            case 2: return "LOAD";
-            case 3: return "STORE";
-            case 4: return "INPUT";
-            case 5: return "OUTPUT";
-            case 6: return "JUMP";
-            case 7: return "CALL";
-            case 8: return "RET";
-            default: return "UNKNOWN";
+    // Interprets from programCounter through the next control transfer; returns false
+    // when that transfer reached the instruction limit
+    template <class Trace>
+    bool interpretBlock(Trace& trace) {
+        const int programSize = decodedProgram.size();
+        while (programCounter < programSize) {
+            const DecodedInstruction& instruction = decodedProgram[programCounter];
+            switch (instruction.type) {
+                case ADD: step<ADD>(instruction, trace); break;
+                case SUB: step<SUB>(instruction, trace); break;
+                case LOAD: step<LOAD>(instruction, trace); break;
+                case STORE: step<STORE>(instruction, trace); break;
+                case INPUT: step<INPUT>(instruction, trace); break;
+                case OUTPUT: step<OUTPUT>(instruction, trace); break;
+                case JUMP: step<JUMP>(instruction, trace); return instructionsRetired < instructionLimit;
+                case CALL: step<CALL>(instruction, trace); return instructionsRetired < instructionLimit;
+                case RET: step<RET>(instruction, trace); return instructionsRetired < instructionLimit;
+                default: step<UNKNOWN>(instruction, trace); break;
+            }
+        }
+        return true;
+    }
+
+    // JIT engine: blocks run interpreted until they are hot, then as native code that
+    // chains directly from block to block. Only untraced runs are compiled; traced runs
+    // and platforms without the JIT use the block engine.
+    template <class Trace>
+    void runJit(Trace& trace) {
+#ifdef VCPU_HAVE_JIT
+        if constexpr (is_same<Trace, TraceOff>::value) {
+            if (!jit) {
+                jit.reset(new JitCompiler());
+                flushJit();
+            }
+            if (jit->isReady()) {
+                const int programSize = decodedProgram.size();
+                JitState state = {registers.regs, nullptr, memory.size(), nullptr, 0, counters.retired, instructionLimit, 0,
+                                  jitCode.data(), static_cast<uint64_t>(programSize), this,
+                                  &jitInput, &jitOutput, &jitReadOutOfBounds, &jitWriteOutOfBounds};
+                // Native code works on the first page and the return slot directly. They are
+                // made writable (so unshared and resident) only once compiled code stores or
+                // calls, and rebound after interpreted code, which may have copied them. The
+                // return slot goes first: making it writable can copy the first page.
+                auto bindMemory = [&]() {
+                    size_t last = memory.size() - 1;
+                    state.returnSlot = jitCalls ? memory.writableCell(last) : const_cast<Word*>(memory.readableCell(last));
+                    state.memory = jitStores ? memory.writableCell(0) : const_cast<Word*>(memory.readableCell(0));
+                };
+                bindMemory();
+                while (programCounter < programSize) {
+                    const void* code = jitCode[programCounter];
+                    if (code == nullptr && ++jitHeat[programCounter] >= JIT_HOT_THRESHOLD) {
+                        code = jit->translate(decodedProgram.data(), programSize, programCounter, memory.size());
+                        if (code == nullptr) {
+                            // Code buffer full: start over with only this block
+                            flushJit();
+                            code = jit->translate(decodedProgram.data(), programSize, programCounter, memory.size());
+                        }
+                        jitCode[programCounter] = code;
+                        if (code != nullptr) {
+                            noteJitWrites(programCounter);
+                            bindMemory();
+                        }
+                    }
+                    if (code != nullptr) {
+                        state.pc = programCounter;
+                        state.retired = instructionsRetired;
+                        jit->run(state, code);
+                        programCounter = state.pc;
+                        instructionsRetired = state.retired;
+                        // Native code only returns below the limit to reach a block it has no code for
+                        if (instructionsRetired >= instructionLimit) return;
+                    } else if (!interpretBlock(trace)) {
+                        return;
+                    } else {
+                        bindMemory();
+                    }
+                }
+                return;
+            }
+        }
+#endif
+        lastRunEngine = BLOCK_ENGINE;
+        runBlocks(trace);
+    }
+
+#ifdef VCPU_HAVE_JIT
+    // Runtime callbacks for native code
+    static void jitInput(void* context, int reg) {
+        CPU* cpu = static_cast<CPU*>(context);
+        cpu->registers.set(reg, cpu->readInput(reg));
+    }
+    static void jitOutput(void* context, int reg) {
+        CPU* cpu = static_cast<CPU*>(context);
+        cpu->writeOutput(reg, cpu->registers.get(reg));
+    }
+    static Word jitReadOutOfBounds(void* context, uint64_t address) {
+        return static_cast<CPU*>(context)->memory.read(address);
+    }
+    static void jitWriteOutOfBounds(void* context, uint64_t address, Word value) {
+        static_cast<CPU*>(context)->memory.write(address, value);
+    }
+#endif
+
+    int readInput(int reg) {
+        int value = 0;
+        *console << "Enter value for R" << reg << ": ";
+        *input >> value;
+        return value;
+    }
+    void writeOutput(int reg, Word value) {
+        *console << "Output value from R" << reg << ": " << static_cast<int>(value) << endl;
+    }
+
+    // Semantics of one instruction, shared by every engine and trace level
+    template <InstructionType Op, class Trace>
+    void step(const DecodedInstruction& instruction, Trace& trace) {
+        trace.fetch(programCounter, instruction);
+        programCounter++;
+        instructionsRetired++;
+        counters.retired[Op]++;
+
+        int reg1 = instruction.reg1;
+        int reg2 = instruction.reg2;
+        Word operand1 = registers.get(reg1);
+        Word operand2 = registers.get(reg2);
+        trace.decode(instruction, operand1, operand2);
+
+        if constexpr (Op == INPUT) {
+            int value = readInput(reg1);
+            registers.set(reg1, value);
+            trace.input(reg1, value);
+        } else if constexpr (Op == OUTPUT) {
+            writeOutput(reg1, operand1);
+            trace.output(reg1, operand1);
+        } else if constexpr (Op == JUMP) {
+            programCounter = operand2;
+            trace.jump(operand2);
+        } else if constexpr (Op == CALL) {
+            size_t returnSlot = memory.size() - 1;
+            if (memory.write(returnSlot, programCounter)) trace.memoryWrite(returnSlot, programCounter);
+            programCounter = operand2;
+            trace.call(operand2);
+        } else if constexpr (Op == RET) {
+            programCounter = memory.read(memory.size() - 1);
+            trace.ret(programCounter);
+        } else if constexpr (Op == LOAD) {
+            Word value = memory.read(operand2);
+            registers.set(reg1, value);
+            trace.load(reg1, value);
+        } else if constexpr (Op == STORE) {
+            if (memory.write(operand2, operand1)) trace.memoryWrite(operand2, operand1);
+            trace.store(operand1, operand2);
+        } else {
+            Word result = alu.performOperation(Op, operand1, operand2);
+            registers.set(reg1, result);
+            trace.alu(instruction, result);
         }
+
+        trace.retire(registers, memory);
     }
 };
 
-// Assembler function
-vector<int> assemble(const string& assemblyCode) {
+// Original istringstream assembler, kept as the reference for --bench-assembler
+vector<int> assembleReference(const string& assemblyCode) {
     map<string, int> opcodes = {{"ADD", 0}, {"SUB", 1}, {"LOAD", 2}, {"STORE", 3}, {"INPUT", 4}, {"OUTPUT", 5}, {"JUMP", 6}, {"CALL", 7}, {"RET", 8}};
     map<string, int> registers = {{"R0", 0}, {"R1", 1}, {"R2", 2}, {"R3", 3}};
     istringstream iss(assemblyCode);
@@ -196,61 +857,1006 @@ vector<int> assemble(const string& assemblyCode) {
         istringstream linestream(line);
         string opcode, reg1, reg2;
         linestream >> opcode >> reg1 >> reg2;
-        int machineInstruction = (opcodes[opcode] << 6) | (registers[reg1] << 3) | registers[reg2];
+        int machineInstruction = (opcodes[opcode] << OPCODE_SHIFT) | (registers[reg1] << 3) | registers[reg2];
         machineCode.push_back(machineInstruction);
     }
     return machineCode;
 }
 
-int main() {
-    CPU cpu;
-    string assemblyCode;
+// Levels a bare --cache models; registers address at most 256 cells, so the caches are tiny too
+const char* const DEFAULT_CACHE_LEVELS = "16:4:2:lru,64:8:4:lru";
+
+// Parses cache levels such as "1K:16:2:lru,8K:32:4", L1 first. Sizes, line sizes and
+// associativities must be powers of two, and each level must hold at least one set.
+bool parseCacheLevels(const string& text, vector<CacheConfig>& levels) {
+    auto powerOfTwo = [](size_t value) { return value != 0 && (value & (value - 1)) == 0; };
+    levels.clear();
+    istringstream specs(text);
+    string spec;
+    while (getline(specs, spec, ',')) {
+        istringstream fields(spec);
+        string size, lineSize, ways, policy;
+        CacheConfig level;
+        if (!getline(fields, size, ':') || !getline(fields, lineSize, ':') || !getline(fields, ways, ':')) {
+            return false;
+        }
+        getline(fields, policy);
+        if (!parseNumber(lineSize, level.lineSize) || !parseNumber(ways, level.ways)) {
+            return false;
+        }
+        if (!parseMemorySize(size, level.size) || !powerOfTwo(level.size) || !powerOfTwo(level.lineSize) ||
+            !powerOfTwo(level.ways) || level.size < level.lineSize * level.ways) {
+            return false;
+        }
+        if (policy == "fifo") level.policy = REPLACE_FIFO;
+        else if (policy == "random") level.policy = REPLACE_RANDOM;
+        else if (policy.empty() || policy == "lru") level.policy = REPLACE_LRU;
+        else return false;
+        levels.push_back(level);
+    }
+    return !levels.empty();
+}
+
+// Parses a comma-separated list of predictor names
+bool parsePredictors(const string& text, vector<PredictorKind>& predictors) {
+    predictors.clear();
+    istringstream names(text);
+    string name;
+    while (getline(names, name, ',')) {
+        int kind = 0;
+        while (kind < PREDICTOR_KINDS && name != predictorName(static_cast<PredictorKind>(kind))) ++kind;
+        if (kind == PREDICTOR_KINDS) return false;
+        predictors.push_back(static_cast<PredictorKind>(kind));
+    }
+    return !predictors.empty();
+}
+
+// Command-line options
+struct Options {
+    string inputPath = "input.txt";
+    string objectPath;       // load this object image instead of assembling inputPath
+    string emitObjectPath;   // assemble inputPath into this object image and exit
+    string dataPath;         // raw bytes for the emitted image's data section
+    uint64_t dataAddress = 0;
+    bool incremental = false;
+    string assemblerCachePath;  // sidecar for --incremental; defaults to inputPath + ".asmcache"
+    unsigned assemblerThreads = 1;  // 0 uses every hardware thread
+    EngineType engine = SWITCH_ENGINE;
+    TraceLevel traceLevel = TRACE_FULL;
+    bool traceRequested = false;      // a --trace level was given explicitly
+    bool benchmark = false;
+    size_t assemblerBenchmarkLines = 0;
+    size_t snapshotBenchmarkRuns = 0;
+    size_t patchBenchmarkRounds = 0;
+    uint64_t maxInstructions = UINT64_MAX;
+    size_t memorySize = DEFAULT_MEMORY_SIZE;
+    string traceFile = "trace.bin";
+    bool teeToConsole = true;
+    size_t sinkBufferSize = OutputSink::DEFAULT_CAPACITY;
+    string batchManifest;             // run every program listed here instead of inputPath
+    string batchOutput = "batch";     // directory for per-job output and results.tsv
+    unsigned batchThreads = 0;        // 0 uses every hardware thread
+    string lockstepSweep;             // run the program once per lane of this sweep file, in lockstep
+    vector<CacheConfig> caches;       // cache levels to model, L1 first; empty for no cache model
+    vector<PredictorKind> predictors; // branch predictors to compare; empty for no branch model
+    int mispredictPenalty = 3;        // cycles charged per misprediction in the branch report
+    bool pipeline = false;            // time the run on the 5-stage pipeline model
+    bool forwarding = true;
+    bool outOfOrder = false;          // time the run on the out-of-order model
+    OutOfOrderConfig outOfOrderConfig;
+    string countersPath;              // write the performance counters here as JSON at exit
+};
+
+void printUsage() {
+    cout << "Usage: performance [--input=PATH|-] [--object=PATH] [--emit-object=PATH [--data=PATH] [--data-address=N]] [--incremental[=CACHE]] [--assembler-threads=N] [--engine=switch|threaded|block|fused|jit] [--trace=off|summary|full|delta|binary] [--trace-file=PATH] [--no-tee] [--sink-buffer=N[K|M]] [--max-instructions=N] [--memory-size=N[K|M|G]] [--benchmark] [--bench-assembler=LINES] [--bench-snapshots=RUNS] [--bench-patching=ROUNDS] [--batch=MANIFEST [--batch-output=DIR] [--batch-threads=N]] [--lockstep=SWEEP] [--cache[=SIZE:LINE:WAYS[:lru|fifo|random],...]] [--branch-predictors[=static,bimodal,gshare,ras]] [--mispredict-penalty=N] [--pipeline[=forwarding|no-forwarding]] [--out-of-order[=WIDTH:ROB:RS]] [--counters=PATH]" << endl;
+}
 
-    // Load assembly code from a file
-    ifstream inputFile("input.txt");
-    if (inputFile.is_open()) {
-        string line;
-        while (getline(inputFile, line)) {
-            assemblyCode += line + "\n";
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        // Parses the value of a numeric option, reporting it if it is not a valid number
+        auto number = [&](auto& value) {
+            if (parseNumber(arg.substr(arg.find('=') + 1), value)) return true;
+            cout << "Invalid number: " << arg << endl;
+            return false;
+        };
+        if (arg.rfind("--input=", 0) == 0) {
+            options.inputPath = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--object=", 0) == 0) {
+            options.objectPath = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--emit-object=", 0) == 0) {
+            options.emitObjectPath = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--data=", 0) == 0) {
+            options.dataPath = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--data-address=", 0) == 0) {
+            if (!number(options.dataAddress)) return false;
+        } else if (arg == "--incremental") {
+            options.incremental = true;
+        } else if (arg.rfind("--incremental=", 0) == 0) {
+            options.incremental = true;
+            options.assemblerCachePath = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--assembler-threads=", 0) == 0) {
+            if (!number(options.assemblerThreads)) return false;
+        } else if (arg.rfind("--batch=", 0) == 0) {
+            options.batchManifest = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--batch-output=", 0) == 0) {
+            options.batchOutput = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--batch-threads=", 0) == 0) {
+            if (!number(options.batchThreads)) return false;
+        } else if (arg.rfind("--lockstep=", 0) == 0) {
+            options.lockstepSweep = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--engine=switch") {
+            options.engine = SWITCH_ENGINE;
+        } else if (arg == "--engine=threaded") {
+            options.engine = THREADED_ENGINE;
+        } else if (arg == "--engine=block") {
+            options.engine = BLOCK_ENGINE;
+        } else if (arg == "--engine=fused") {
+            options.engine = FUSED_ENGINE;
+        } else if (arg == "--engine=jit") {
+            options.engine = JIT_ENGINE;
+        } else if (arg == "--trace=off") {
+            options.traceLevel = TRACE_OFF;
+            options.traceRequested = true;
+        } else if (arg == "--trace=summary") {
+            options.traceLevel = TRACE_SUMMARY;
+            options.traceRequested = true;
+        } else if (arg == "--trace=full") {
+            options.traceLevel = TRACE_FULL;
+            options.traceRequested = true;
+        } else if (arg == "--trace=delta") {
+            options.traceLevel = TRACE_DELTA;
+            options.traceRequested = true;
+        } else if (arg == "--trace=binary") {
+            options.traceLevel = TRACE_BINARY;
+            options.traceRequested = true;
+        } else if (arg.rfind("--trace-file=", 0) == 0) {
+            options.traceFile = arg.substr(arg.find('=') + 1);
+        } else if (arg.rfind("--max-instructions=", 0) == 0) {
+            if (!number(options.maxInstructions)) return false;
+        } else if (arg.rfind("--memory-size=", 0) == 0) {
+            if (!parseMemorySize(arg.substr(arg.find('=') + 1), options.memorySize)) {
+                cout << "Invalid memory size: " << arg << endl;
+                return false;
+            }
+        } else if (arg == "--no-tee") {
+            options.teeToConsole = false;
+        } else if (arg.rfind("--sink-buffer=", 0) == 0) {
+            if (!parseMemorySize(arg.substr(arg.find('=') + 1), options.sinkBufferSize)) {
+                cout << "Invalid buffer size: " << arg << endl;
+                return false;
+            }
+        } else if (arg == "--cache") {
+            parseCacheLevels(DEFAULT_CACHE_LEVELS, options.caches);
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            if (!parseCacheLevels(arg.substr(arg.find('=') + 1), options.caches)) {
+                cout << "Invalid cache levels: " << arg << endl;
+                return false;
+            }
+        } else if (arg == "--branch-predictors") {
+            options.predictors = {PREDICT_STATIC, PREDICT_BIMODAL, PREDICT_GSHARE, PREDICT_RAS};
+        } else if (arg.rfind("--branch-predictors=", 0) == 0) {
+            if (!parsePredictors(arg.substr(arg.find('=') + 1), options.predictors)) {
+                cout << "Invalid branch predictors: " << arg << endl;
+                return false;
+            }
+        } else if (arg.rfind("--mispredict-penalty=", 0) == 0) {
+            if (!number(options.mispredictPenalty)) return false;
+        } else if (arg == "--pipeline" || arg == "--pipeline=forwarding") {
+            options.pipeline = true;
+        } else if (arg == "--pipeline=no-forwarding") {
+            options.pipeline = true;
+            options.forwarding = false;
+        } else if (arg == "--out-of-order") {
+            options.outOfOrder = true;
+        } else if (arg.rfind("--out-of-order=", 0) == 0) {
+            OutOfOrderConfig& config = options.outOfOrderConfig;
+            char separator1 = 0, separator2 = 0;
+            istringstream fields(arg.substr(arg.find('=') + 1));
+            if (!(fields >> config.width >> separator1 >> config.reorderBuffer >> separator2 >> config.reservationStations) ||
+                separator1 != ':' || separator2 != ':' || config.width < 1 || config.reorderBuffer < 1 ||
+                config.reservationStations < 1) {
+                cout << "Invalid out-of-order configuration: " << arg << endl;
+                return false;
+            }
+            options.outOfOrder = true;
+        } else if (arg.rfind("--counters=", 0) == 0) {
+            options.countersPath = arg.substr(arg.find('=') + 1);
+        } else if (arg == "--benchmark") {
+            options.benchmark = true;
+        } else if (arg.rfind("--bench-assembler=", 0) == 0) {
+            if (!number(options.assemblerBenchmarkLines)) return false;
+        } else if (arg.rfind("--bench-snapshots=", 0) == 0) {
+            if (!number(options.snapshotBenchmarkRuns)) return false;
+        } else if (arg.rfind("--bench-patching=", 0) == 0) {
+            if (!number(options.patchBenchmarkRounds)) return false;
+        } else {
+            cout << "Unknown option: " << arg << endl;
+            return false;
+        }
+    }
+    // Models take the place of the trace, so a run with one writes no trace at all
+    if (!options.caches.empty() || !options.predictors.empty() || options.pipeline || options.outOfOrder) {
+        if (options.traceRequested && options.traceLevel != TRACE_OFF) {
+            cout << "--cache, --branch-predictors, --pipeline and --out-of-order replace the trace; use --trace=off" << endl;
+            return false;
         }
-        inputFile.close();
-        cout << "Input loaded from input.txt" << endl;
+        options.traceLevel = TRACE_OFF;
+    }
+    return true;
+}
+
+// Writes the --counters file: one JSON object per engine that ran, in an array when
+// there are several. Returns false if the file cannot be written.
+bool saveCounters(const string& path, const vector<pair<const char*, PerformanceCounters>>& results) {
+    ofstream file(path);
+    bool array = results.size() != 1;
+    if (array) file << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].second.writeJson(file, results[i].first);
+        file << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    if (array) file << "]\n";
+    if (!file.good()) {
+        cout << "Unable to write " << path << endl;
+        return false;
+    }
+    cout << "Performance counters saved in " << path << endl;
+    return true;
+}
+
+// True if the CPU holds the state in the snapshot: program counter, instruction count,
+// registers and memory
+bool sameState(const CPU& cpu, const CPUSnapshot& expected) {
+    if (cpu.programCounter != expected.programCounter || cpu.instructionsRetired != expected.instructionsRetired ||
+        !equal(cpu.registers.regs, cpu.registers.regs + REGISTER_COUNT, expected.registers.regs)) {
+        return false;
+    }
+    Memory expectedMemory(cpu.memory.size());
+    expectedMemory.restore(expected.memory);
+    size_t differences = 0;
+    size_t cells = 0;
+    expectedMemory.forEachNonZero([&](size_t, Word) { ++cells; });
+    cpu.memory.forEachNonZero([&](size_t address, Word value) {
+        differences += expectedMemory.at(address) != value;
+        --cells;
+    });
+    return differences == 0 && cells == 0;
+}
+
+// Runs the same program untraced on every engine from a fresh CPU and reports MIPS for
+// each. INPUT is read once up front and every engine gets its own copy; each engine's
+// console is shown after its run, so neither is timed. Every engine must end in the
+// state the switch engine ends in. Returns false if --counters cannot be written.
+bool benchmarkEngines(const ProgramImage& image, const Options& options) {
+    ostream discard(nullptr);
+    const EngineType engines[] = {SWITCH_ENGINE, THREADED_ENGINE, BLOCK_ENGINE, FUSED_ENGINE, JIT_ENGINE};
+    vector<pair<const char*, PerformanceCounters>> counters;
+    string input;
+    CPUSnapshot reference;
+    vector<const char*> differ;
+    for (EngineType engine : engines) {
+        CPU cpu(options.memorySize);
+        cpu.engine = engine;
+        cpu.traceLevel = TRACE_OFF;
+        cpu.instructionLimit = options.maxInstructions;
+        cpu.loadImage(image);
+        bool readsInput = any_of(cpu.decodedProgram.begin(), cpu.decodedProgram.end(),
+                                 [](const DecodedInstruction& instruction) { return instruction.type == INPUT; });
+        if (engine == SWITCH_ENGINE && readsInput) {
+            input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+        }
+        istringstream engineInput(input);
+        ostringstream engineConsole;
+        cpu.setConsole(engineInput, engineConsole);
+        cpu.executeProgram(discard);
+        cout << engineConsole.str();
+        counters.emplace_back(engineName(cpu.lastRunEngine), cpu.counters);
+        if (engine == SWITCH_ENGINE) {
+            reference = cpu.snapshot();
+        } else if (!sameState(cpu, reference)) {
+            differ.push_back(engineName(engine));
+        }
+    }
+    if (differ.empty()) {
+        cout << "Results match" << endl;
+    } else {
+        cout << "Results DIFFER on the";
+        for (const char* engine : differ) cout << ' ' << engine;
+        cout << " engine" << (differ.size() > 1 ? "s" : "") << endl;
+    }
+    return options.countersPath.empty() || saveCounters(options.countersPath, counters);
+}
+
+// Forks many short runs from one warmed-up state, the way a fuzzer does: the program
+// runs --max-instructions to warm up, then each run changes R0 and runs up to
+// --max-instructions more. The runs start once from a restored snapshot and once from a
+// rebuilt CPU that replays the warm-up, which is the only way back without snapshots.
+// The restored runs must match the rebuilt ones, and also an untimed rebuild on the
+// switch engine, since restoring shares pages that the other engines bind in place.
+// --counters gets the snapshot CPU's counters. Returns false if they cannot be written.
+bool benchmarkSnapshots(const ProgramImage& image, const Options& options, size_t runs) {
+    ostream discard(nullptr);
+    istringstream noInput;
+    auto newCpu = [&](EngineType engine) {
+        unique_ptr<CPU> cpu(new CPU(options.memorySize));
+        cpu->engine = engine;
+        cpu->traceLevel = TRACE_OFF;
+        cpu->instructionLimit = options.maxInstructions;
+        cpu->setConsole(noInput, discard);
+        cpu->loadImage(image);
+        cpu->executeProgram(discard);
+        return cpu;
+    };
+    auto fork = [&](CPU& cpu, size_t run) {
+        cpu.registers.set(0, static_cast<Word>(run));
+        cpu.instructionLimit = cpu.instructionsRetired + min(options.maxInstructions, UINT64_MAX - cpu.instructionsRetired);
+        cpu.executeProgram(discard);
+    };
+
+    unique_ptr<CPU> cpu = newCpu(options.engine);
+    CPUSnapshot warm = cpu->snapshot();
+    vector<CPUSnapshot> results(runs);
+    uint64_t restoreNanoseconds = 0;
+    auto start = high_resolution_clock::now();
+    for (size_t run = 0; run < runs; ++run) {
+        auto restoreStart = high_resolution_clock::now();
+        cpu->restore(warm);
+        restoreNanoseconds += duration_cast<nanoseconds>(high_resolution_clock::now() - restoreStart).count();
+        fork(*cpu, run);
+        results[run] = cpu->snapshot();
+    }
+    uint64_t snapshotNanoseconds = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+
+    size_t mismatches = 0;
+    uint64_t rebuildNanoseconds = 0;
+    start = high_resolution_clock::now();
+    for (size_t run = 0; run < runs; ++run) {
+        auto rebuildStart = high_resolution_clock::now();
+        unique_ptr<CPU> rebuilt = newCpu(options.engine);
+        rebuildNanoseconds += duration_cast<nanoseconds>(high_resolution_clock::now() - rebuildStart).count();
+        fork(*rebuilt, run);
+        mismatches += !sameState(*rebuilt, results[run]);
+    }
+    uint64_t replayNanoseconds = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+    if (options.engine != SWITCH_ENGINE) {
+        for (size_t run = 0; run < runs; ++run) {
+            unique_ptr<CPU> reference = newCpu(SWITCH_ENGINE);
+            fork(*reference, run);
+            mismatches += !sameState(*reference, results[run]);
+        }
+    }
+
+    cout << "Forked " << runs << " runs on the " << engineName(options.engine) << " engine from the state after "
+         << warm.instructionsRetired << " instructions" << endl;
+    cout << "From a snapshot: " << snapshotNanoseconds / 1e6 << " ms, " << restoreNanoseconds / runs << " ns per restore" << endl;
+    cout << "From a rebuild:  " << replayNanoseconds / 1e6 << " ms, " << rebuildNanoseconds / runs << " ns per rebuild" << endl;
+    cout << "Results " << (mismatches == 0 ? "match" : "DIFFER") << endl;
+    return options.countersPath.empty() || saveCounters(options.countersPath, {{engineName(cpu->lastRunEngine), cpu->counters}});
+}
+
+// Patches the program between runs, the way a debugger planting breakpoints or a
+// mutation fuzzer does: each round replaces one pseudo-random instruction through
+// writeInstruction, sets R0 to the round and runs from address 0 for up to
+// --max-instructions. A switch-engine CPU gets the same patches, and both must end
+// every round in the same state, so the translated blocks that the patches drop are
+// checked against a CPU that has none. --counters gets both CPUs' counters. Returns
+// false if they cannot be written.
+bool benchmarkPatching(const ProgramImage& image, const Options& options, size_t rounds) {
+    ostream discard(nullptr);
+    istringstream noInput;
+    auto newCpu = [&](EngineType engine) {
+        unique_ptr<CPU> cpu(new CPU(options.memorySize));
+        cpu->engine = engine;
+        cpu->traceLevel = TRACE_OFF;
+        cpu->setConsole(noInput, discard);
+        cpu->loadImage(image);
+        return cpu;
+    };
+    unique_ptr<CPU> cpu = newCpu(options.engine);
+    unique_ptr<CPU> reference = newCpu(SWITCH_ENGINE);
+    auto run = [&](CPU& target, size_t round) {
+        target.programCounter = 0;
+        target.registers.set(0, static_cast<Word>(round));
+        target.instructionLimit = target.instructionsRetired + min(options.maxInstructions, UINT64_MAX - target.instructionsRetired);
+        target.executeProgram(discard);
+    };
+
+    size_t mismatches = 0;
+    uint64_t instructions = 0;
+    uint64_t nanoseconds = 0;
+    uint32_t seed = 12345;
+    run(*cpu, 0);
+    run(*reference, 0);
+    for (size_t round = 1; round <= rounds && image.codeSize > 0; ++round) {
+        seed = seed * 1103515245 + 12345;
+        size_t address = (seed >> 8) % image.codeSize;
+        int instruction = (seed >> 20) & 0x3FF;
+        cpu->writeInstruction(address, instruction);
+        reference->writeInstruction(address, instruction);
+        uint64_t retiredBefore = cpu->instructionsRetired;
+        run(*cpu, round);
+        run(*reference, round);
+        instructions += cpu->instructionsRetired - retiredBefore;
+        nanoseconds += cpu->lastRunNanoseconds;
+        mismatches += !sameState(*cpu, reference->snapshot());
+    }
+
+    cout << "Patched " << rounds << " instructions on the " << engineName(options.engine) << " engine: "
+         << instructions << " instructions in " << nanoseconds / 1e6 << " ms after the first run, "
+         << cpu->blocksDropped << " blocks dropped, " << cpu->blockCompactions << " compactions" << endl;
+    cout << "Results " << (mismatches == 0 ? "match" : "DIFFER") << endl;
+    return options.countersPath.empty() ||
+           saveCounters(options.countersPath, {{engineName(cpu->lastRunEngine), cpu->counters},
+                                               {engineName(reference->lastRunEngine), reference->counters}});
+}
+
+// Generates a program of the given length mixing every opcode, register and some
+// irregular spacing, then times the reference and single-pass assemblers on it
+void benchmarkAssembler(size_t lines, unsigned threads) {
+    static const char* const opcodes[] = {"ADD", "SUB", "LOAD", "STORE", "INPUT", "OUTPUT", "JUMP", "CALL", "RET"};
+    string source;
+    source.reserve(lines * 12);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < lines; ++i) {
+        seed = seed * 1103515245 + 12345;
+        source += opcodes[(seed >> 16) % 9];
+        source += (seed & 0x100) ? "  R" : " R";
+        source += static_cast<char>('0' + ((seed >> 10) & 3));
+        source += " R";
+        source += static_cast<char>('0' + ((seed >> 12) & 3));
+        source += (seed & 0x200) ? "\r\n" : "\n";
+    }
+
+    auto start = high_resolution_clock::now();
+    vector<int> reference = assembleReference(source);
+    auto middle = high_resolution_clock::now();
+    vector<int> fast = assemble(source);
+    auto end = high_resolution_clock::now();
+
+    double referenceMs = duration_cast<microseconds>(middle - start).count() / 1000.0;
+    double fastMs = duration_cast<microseconds>(end - middle).count() / 1000.0;
+    cout << "Assembled " << lines << " lines (" << source.size() / (1024 * 1024.0) << " MiB)" << endl;
+    cout << "Reference assembler:   " << referenceMs << " ms" << endl;
+    cout << "Single-pass assembler: " << fastMs << " ms" << endl;
+    cout << "Outputs " << (reference == fast ? "match" : "DIFFER") << endl;
+
+    start = high_resolution_clock::now();
+    vector<int> parallel = assembleParallel(source, threads);
+    end = high_resolution_clock::now();
+    double parallelMs = duration_cast<microseconds>(end - start).count() / 1000.0;
+    cout << "Parallel assembler:    " << parallelMs << " ms ("
+         << (threads == 0 ? thread::hardware_concurrency() : threads) << " threads)" << endl;
+    cout << "Outputs " << (parallel == fast ? "match" : "DIFFER") << endl;
+
+    // Edit one line in the middle and re-assemble from the cache of the first run
+    IncrementalAssembler incremental;
+    incremental.assemble(source);
+    size_t middleLine = source.find('\n', source.size() / 2) + 1;
+    source[middleLine] = source[middleLine] == 'A' ? 'S' : 'A';
+    start = high_resolution_clock::now();
+    const vector<int>& patched = incremental.assemble(source);
+    middle = high_resolution_clock::now();
+    fast = assemble(source);
+    double incrementalMs = duration_cast<microseconds>(middle - start).count() / 1000.0;
+    cout << "Incremental assembler: " << incrementalMs << " ms after a one-line edit (" << incremental.linesEncoded()
+         << " lines re-encoded)" << endl;
+    cout << "Outputs " << (patched == fast ? "match" : "DIFFER") << endl;
+
+    // Two edits far apart: a line inserted a quarter of the way in, one changed three quarters in
+    size_t quarterLine = source.find('\n', source.size() / 4) + 1;
+    source.insert(quarterLine, "SUB R3 R2\n");
+    size_t lastQuarterLine = source.find('\n', source.size() * 3 / 4) + 1;
+    source[lastQuarterLine] = source[lastQuarterLine] == 'A' ? 'S' : 'A';
+    start = high_resolution_clock::now();
+    const vector<int>& repatched = incremental.assemble(source);
+    middle = high_resolution_clock::now();
+    fast = assemble(source);
+    incrementalMs = duration_cast<microseconds>(middle - start).count() / 1000.0;
+    cout << "Incremental assembler: " << incrementalMs << " ms after two edits far apart ("
+         << incremental.linesEncoded() << " lines re-encoded)" << endl;
+    cout << "Outputs " << (repatched == fast ? "match" : "DIFFER") << endl;
+}
+
+// One line of a batch manifest: a program (assembly, or an object image ending in
+// .vobj) and optionally a file its INPUT instructions read from
+struct BatchJob {
+    string programPath;
+    string inputPath;
+};
+
+struct BatchResult {
+    string error;  // empty when the job ran
+    uint64_t instructions = 0;
+    uint64_t nanoseconds = 0;
+    Word registers[NAMED_REGISTERS] = {};
+    unsigned worker = 0;
+    EngineType engine = SWITCH_ENGINE;  // the engine that ran the job
+    PerformanceCounters counters;
+};
+
+// Reads "program [input]" lines; blank lines and lines starting with '#' are skipped.
+// Relative paths are taken relative to the manifest.
+bool readManifest(const string& path, vector<BatchJob>& jobs) {
+    ifstream manifest(path);
+    if (!manifest.is_open()) {
+        return false;
+    }
+    filesystem::path directory = filesystem::path(path).parent_path();
+    string line;
+    while (getline(manifest, line)) {
+        istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.programPath) || job.programPath[0] == '#') {
+            continue;
+        }
+        fields >> job.inputPath;
+        job.programPath = (directory / job.programPath).string();
+        if (!job.inputPath.empty()) {
+            job.inputPath = (directory / job.inputPath).string();
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// Loads one job's program and runs it untraced in its own CPU, with console as its console
+BatchResult runBatchJob(const BatchJob& job, const Options& options, ostream& console) {
+    BatchResult result;
+    ObjectImage objectImage;
+    vector<int> machineCode;
+    ProgramImage image;
+    string error;
+    if (job.programPath.size() > 5 && job.programPath.compare(job.programPath.size() - 5, 5, ".vobj") == 0) {
+        if (!objectImage.open(job.programPath, error)) {
+            result.error = error;
+            return result;
+        }
+        image = {objectImage.code(), objectImage.codeSize(), objectImage.data(), objectImage.dataSize(),
+                 objectImage.dataAddress()};
     } else {
-        cout << "Unable to open input.txt" << endl;
+        MappedFile source;
+        if (!source.open(job.programPath)) {
+            result.error = "unable to open " + job.programPath;
+            return result;
+        }
+        machineCode = assemble(source.view());
+        image.code = machineCode.data();
+        image.codeSize = machineCode.size();
+    }
+
+    ifstream inputFile;
+    istringstream noInput;
+    if (!job.inputPath.empty()) {
+        inputFile.open(job.inputPath);
+        if (!inputFile.is_open()) {
+            result.error = "unable to open " + job.inputPath;
+            return result;
+        }
+    }
+
+    CPU cpu(options.memorySize);
+    cpu.engine = options.engine;
+    cpu.traceLevel = TRACE_OFF;
+    cpu.instructionLimit = options.maxInstructions;
+    cpu.setConsole(job.inputPath.empty() ? static_cast<istream&>(noInput) : inputFile, console);
+    if (!cpu.loadImage(image)) {
+        result.error = "data section does not fit in memory";
+        return result;
+    }
+    ostream discard(nullptr);
+    cpu.executeProgram(discard);
+    result.instructions = cpu.instructionsRetired;
+    result.nanoseconds = cpu.lastRunNanoseconds;
+    result.engine = cpu.lastRunEngine;
+    result.counters = cpu.counters;
+    copy(cpu.registers.regs, cpu.registers.regs + NAMED_REGISTERS, result.registers);
+    return result;
+}
+
+// Runs every job of the manifest on a work-stealing pool. Each job's console goes to
+// DIR/<job>.out, and DIR/results.tsv gets one row of results and timing per job.
+int runBatch(const Options& options) {
+    vector<BatchJob> jobs;
+    if (!readManifest(options.batchManifest, jobs)) {
+        cout << "Unable to open " << options.batchManifest << endl;
+        return 1;
+    }
+    error_code error;
+    filesystem::create_directories(options.batchOutput, error);
+    if (error) {
+        cout << "Unable to create " << options.batchOutput << ": " << error.message() << endl;
+        return 1;
+    }
+
+    WorkStealingPool pool(options.batchThreads);
+    vector<BatchResult> results(jobs.size());
+    auto start = high_resolution_clock::now();
+    pool.run(jobs.size(), [&](size_t index, unsigned worker) {
+        ofstream console(options.batchOutput + "/" + to_string(index) + ".out");
+        results[index] = runBatchJob(jobs[index], options, console);
+        results[index].worker = worker;
+    });
+    auto end = high_resolution_clock::now();
+
+    ofstream table(options.batchOutput + "/results.tsv");
+    table << "job\tprogram\tstatus\tinstructions\tmicroseconds\tmips\tR0\tR1\tR2\tR3\tworker\n";
+    size_t failed = 0;
+    uint64_t instructions = 0;
+    // Every job runs untraced with the same options, so the jobs that ran share one engine
+    const char* engine = engineName(options.engine);
+    PerformanceCounters counters;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const BatchResult& result = results[i];
+        failed += !result.error.empty();
+        instructions += result.instructions;
+        if (result.error.empty()) engine = engineName(result.engine);
+        counters.add(result.counters);
+        table << i << '\t' << jobs[i].programPath << '\t' << (result.error.empty() ? "ok" : result.error) << '\t'
+              << result.instructions << '\t' << result.nanoseconds / 1000 << '\t'
+              << CPU::mips(result.instructions, result.nanoseconds);
+        for (Word value : result.registers) {
+            table << '\t' << static_cast<int>(value);
+        }
+        table << '\t' << result.worker << '\n';
+    }
+
+    double milliseconds = duration_cast<microseconds>(end - start).count() / 1000.0;
+    cout << "Ran " << jobs.size() << " jobs (" << failed << " failed) on " << pool.size() << " threads in "
+         << milliseconds << " ms, " << instructions << " instructions" << endl;
+    cout << "Results saved in " << options.batchOutput << "/results.tsv" << endl;
+    if (!options.countersPath.empty() && !saveCounters(options.countersPath, {{engine, counters}})) {
+        return 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+// Reads a sweep file: one lane per line, "R0 R1 R2 R3 address=value ...". Registers left
+// out keep their usual initial values; blank lines and lines starting with '#' are skipped.
+// Values are 0-255 and addresses plain numbers; anything else is reported and rejected.
+bool readSweep(const string& path, vector<LaneSetup>& lanes) {
+    ifstream sweep(path);
+    if (!sweep.is_open()) {
+        cout << "Unable to open " << path << endl;
+        return false;
+    }
+    string line;
+    size_t lineNumber = 0;
+    auto badField = [&](const string& field) {
+        cout << "Invalid sweep field '" << field << "' on line " << lineNumber << " of " << path << endl;
+        return false;
+    };
+    while (getline(sweep, line)) {
+        ++lineNumber;
+        istringstream fields(line);
+        string field;
+        LaneSetup lane;
+        int reg = 0;
+        bool any = false;
+        while (fields >> field) {
+            if (!any && field[0] == '#') break;
+            any = true;
+            size_t equals = field.find('=');
+            Word value = 0;
+            if (equals == string::npos) {
+                if (!parseNumber(field, value)) return badField(field);
+                if (reg < NAMED_REGISTERS) lane.registers[reg++] = value;
+            } else {
+                size_t address = 0;
+                if (!parseNumber(field.substr(0, equals), address) || !parseNumber(field.substr(equals + 1), value)) {
+                    return badField(field);
+                }
+                lane.memory.emplace_back(address, value);
+            }
+        }
+        if (any) {
+            lanes.push_back(lane);
+        }
+    }
+    return true;
+}
+
+// Runs the program once per lane of the sweep, LOCKSTEP_LANES lanes at a time, and writes
+// every lane's final registers to lockstep.tsv. With --benchmark each lane is also run
+// on its own CPU to compare the results and the time.
+int runLockstep(const ProgramImage& image, const Options& options) {
+    if (options.memorySize > LOCKSTEP_MAX_MEMORY) {
+        cout << "Lockstep lanes have dense memory; --memory-size can be at most " << LOCKSTEP_MAX_MEMORY << " cells" << endl;
+        return 1;
+    }
+    vector<LaneSetup> lanes;
+    if (!readSweep(options.lockstepSweep, lanes)) {
+        return 1;
+    }
+    vector<DecodedInstruction> program(image.codeSize);
+    for (size_t i = 0; i < image.codeSize; ++i) {
+        program[i] = decodeInstruction(image.code[i]);
+    }
+
+    vector<unique_ptr<LockstepGroup>> groups;
+    for (size_t first = 0; first < lanes.size(); first += LOCKSTEP_LANES) {
+        int count = min<size_t>(LOCKSTEP_LANES, lanes.size() - first);
+        groups.emplace_back(new LockstepGroup(program, options.memorySize, count, first));
+        if (!groups.back()->loadData(image.dataAddress, image.data, image.dataSize)) {
+            cout << "Data section does not fit in " << options.memorySize << " memory cells; use --memory-size" << endl;
+            return 1;
+        }
+        for (int lane = 0; lane < count; ++lane) {
+            if (!groups.back()->setLane(lane, lanes[first + lane])) {
+                cout << "Sweep line " << first + lane + 1 << " presets a cell outside memory" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // When benchmarking, the lanes write their console to memory like the separate CPUs
+    // do below, and it is shown once the timing is done
+    uint64_t instructions = 0;
+    uint64_t steps = 0;
+    ostringstream bufferedConsole;
+    ostream& console = options.benchmark ? static_cast<ostream&>(bufferedConsole) : cout;
+    auto start = high_resolution_clock::now();
+    for (auto& group : groups) {
+        group->run(options.maxInstructions, cin, console);
+    }
+    uint64_t lockstepNanoseconds = duration_cast<nanoseconds>(high_resolution_clock::now() - start).count();
+    cout << bufferedConsole.str();
+
+    ofstream table("lockstep.tsv");
+    table << "lane\tinstructions\tR0\tR1\tR2\tR3\n";
+    for (size_t i = 0; i < lanes.size(); ++i) {
+        const LockstepGroup& group = *groups[i / LOCKSTEP_LANES];
+        int lane = i % LOCKSTEP_LANES;
+        table << i << '\t' << group.instructionsRetired(lane);
+        for (int reg = 0; reg < NAMED_REGISTERS; ++reg) {
+            table << '\t' << static_cast<int>(group.registerValue(lane, reg));
+        }
+        table << '\n';
+        instructions += group.instructionsRetired(lane);
+    }
+    PerformanceCounters lockstepCounters;
+    for (auto& group : groups) {
+        steps += group->steps();
+        lockstepCounters.add(group->performanceCounters());
+    }
+    lockstepCounters.hostNanoseconds = lockstepNanoseconds;
+    lockstepCounters.runs = lanes.size();
+    vector<pair<const char*, PerformanceCounters>> counters = {{"lockstep", lockstepCounters}};
+    cout << "Ran " << lanes.size() << " lanes in " << groups.size() << " groups: " << instructions << " instructions in "
+         << lockstepNanoseconds / 1e6 << " ms (" << CPU::mips(instructions, lockstepNanoseconds) << " MIPS), "
+         << (steps == 0 ? 0.0 : static_cast<double>(instructions) / steps) << " lanes per dispatch" << endl;
+    cout << "Results saved in lockstep.tsv" << endl;
+
+    if (options.benchmark) {
+        ostream discard(nullptr);
+        istringstream noInput;
+        size_t mismatches = 0;
+        uint64_t separateNanoseconds = 0;
+        PerformanceCounters separateCounters;
+        const char* separateEngine = engineName(options.engine);
+        for (size_t i = 0; i < lanes.size(); ++i) {
+            ostringstream laneConsole;
+            CPU cpu(options.memorySize);
+            cpu.engine = options.engine;
+            cpu.traceLevel = TRACE_OFF;
+            cpu.instructionLimit = options.maxInstructions;
+            cpu.setConsole(noInput, laneConsole);
+            cpu.loadImage(image);
+            copy(lanes[i].registers, lanes[i].registers + REGISTER_COUNT, cpu.registers.regs);
+            for (const auto& cell : lanes[i].memory) {
+                cpu.memory.write(cell.first, cell.second);
+            }
+            cpu.executeProgram(discard);
+            separateNanoseconds += cpu.lastRunNanoseconds;
+            separateCounters.add(cpu.counters);
+            separateEngine = engineName(cpu.lastRunEngine);
+            const LockstepGroup& group = *groups[i / LOCKSTEP_LANES];
+            int lane = i % LOCKSTEP_LANES;
+            bool same = cpu.instructionsRetired == group.instructionsRetired(lane);
+            for (int reg = 0; reg < REGISTER_COUNT; ++reg) {
+                same = same && cpu.registers.get(reg) == group.registerValue(lane, reg);
+            }
+            for (size_t address = 0; same && address < options.memorySize; ++address) {
+                same = cpu.memory.read(address) == group.memoryValue(lane, address);
+            }
+            mismatches += !same;
+        }
+        cout << "Separate CPUs (" << separateEngine << " engine): " << separateNanoseconds / 1e6 << " ms ("
+             << CPU::mips(instructions, separateNanoseconds) << " MIPS), "
+             << (lockstepNanoseconds == 0 ? 0.0 : static_cast<double>(separateNanoseconds) / lockstepNanoseconds) << "x the lockstep time, "
+             << mismatches << " lanes differ" << endl;
+        counters.emplace_back(separateEngine, separateCounters);
+    }
+    if (!options.countersPath.empty() && !saveCounters(options.countersPath, counters)) {
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
         return 1;
     }
 
-    cout << "Sample Assembly Code:\n" << assemblyCode << endl;
+    if (!options.batchManifest.empty()) {
+        return runBatch(options);
+    }
+
+    if (options.assemblerBenchmarkLines > 0) {
+        benchmarkAssembler(options.assemblerBenchmarkLines, options.assemblerThreads == 1 ? 0 : options.assemblerThreads);
+        return 0;
+    }
+
+    CPU cpu(options.memorySize);
+    cpu.engine = options.engine;
+    cpu.traceLevel = options.traceLevel;
+    cpu.binaryTracePath = options.traceFile;
+    cpu.instructionLimit = options.maxInstructions;
+
+    // The listing is part of the text traces; skip it for large untraced runs
+    bool printListing = options.traceLevel == TRACE_FULL || options.traceLevel == TRACE_SUMMARY;
+    ProgramImage image;
+    ObjectImage objectImage;
+    vector<int> machineCode;
+
+    if (!options.objectPath.empty()) {
+        // A prebuilt object image is mapped and used in place, with no parsing
+        string error;
+        if (!objectImage.open(options.objectPath, error)) {
+            cout << "Unable to load object image: " << error << endl;
+            return 1;
+        }
+        cout << "Object image loaded from " << options.objectPath << " (" << objectImage.codeSize()
+             << " instructions, " << objectImage.dataSize() << " data bytes)" << endl;
+        image.code = objectImage.code();
+        image.codeSize = objectImage.codeSize();
+        image.data = objectImage.data();
+        image.dataSize = objectImage.dataSize();
+        image.dataAddress = objectImage.dataAddress();
+    } else {
+        // Map the assembly source read-only; "-" reads it from standard input
+        MappedFile inputFile;
+        if (inputFile.open(options.inputPath)) {
+            cout << "Input loaded from " << options.inputPath << endl;
+        } else {
+            cout << "Unable to open " << options.inputPath << endl;
+            return 1;
+        }
+        string_view assemblyCode = inputFile.view();
+
+        if (printListing) {
+            cout << "Sample Assembly Code:\n" << assemblyCode << endl;
+        }
+
+        // Convert assembly to machine code
+        cout << "\nAssembling code...\n";
+        if (options.incremental && options.inputPath == "-" && options.assemblerCachePath.empty()) {
+            // Standard input has no path to keep a cache next to
+            cout << "No assembler cache for standard input; give one with --incremental=CACHE" << endl;
+            machineCode = assemble(assemblyCode);
+        } else if (options.incremental) {
+            // Reuse the words of unchanged lines from the previous run's cache
+            string cachePath = options.assemblerCachePath.empty() ? options.inputPath + ".asmcache" : options.assemblerCachePath;
+            IncrementalAssembler incremental;
+            incremental.load(cachePath);
+            machineCode = incremental.assemble(assemblyCode);
+            if (!incremental.save(cachePath)) {
+                cout << "Unable to write " << cachePath << endl;
+            }
+            cout << "Incremental assembly: " << incremental.linesReused() << " lines reused, "
+                 << incremental.linesEncoded() << " re-encoded" << endl;
+        } else if (options.assemblerThreads != 1) {
+            machineCode = assembleParallel(assemblyCode, options.assemblerThreads);
+        } else {
+            machineCode = assemble(assemblyCode);
+        }
+        if (printListing) {
+            cout << "Converted Machine Code:\n";
+            for (int code : machineCode) {
+                cout << code << " ";
+            }
+            cout << endl;
+        } else {
+            cout << "Assembled " << machineCode.size() << " instructions" << endl;
+        }
+        image.code = machineCode.data();
+        image.codeSize = machineCode.size();
+
+        if (!options.emitObjectPath.empty()) {
+            vector<Word> data;
+            if (!options.dataPath.empty()) {
+                MappedFile dataFile;
+                if (!dataFile.open(options.dataPath)) {
+                    cout << "Unable to open " << options.dataPath << endl;
+                    return 1;
+                }
+                data.assign(dataFile.view().begin(), dataFile.view().end());
+            }
+            if (!writeObjectImage(options.emitObjectPath, machineCode, data, options.dataAddress)) {
+                cout << "Unable to write " << options.emitObjectPath << endl;
+                return 1;
+            }
+            cout << "Object image written to " << options.emitObjectPath << endl;
+            return 0;
+        }
+    }
+
+    if (!options.lockstepSweep.empty()) {
+        return runLockstep(image, options);
+    }
+
+    if (options.snapshotBenchmarkRuns > 0) {
+        return benchmarkSnapshots(image, options, options.snapshotBenchmarkRuns) ? 0 : 1;
+    }
+
+    if (options.patchBenchmarkRounds > 0) {
+        return benchmarkPatching(image, options, options.patchBenchmarkRounds) ? 0 : 1;
+    }
 
-    // Convert assembly to machine code
-    cout << "\nAssembling code...\n";
-    vector<int> machineCode = assemble(assemblyCode);
-    cout << "Converted Machine Code:\n";
-    for (int code : machineCode) {
-        cout << code << " ";
+    if (options.benchmark) {
+        cout << "\nBenchmarking engines...\n";
+        return benchmarkEngines(image, options) ? 0 : 1;
     }
-    cout << endl;
 
     // Display initial register states
     cout << "\nInitial Register States:\n";
     cpu.registers.display(cout);
 
     // Load and execute program
-    cpu.loadProgram(machineCode);
+    if (!cpu.loadImage(image)) {
+        cout << "Data section does not fit in " << cpu.memory.size() << " memory cells; use --memory-size" << endl;
+        return 1;
+    }
+    unique_ptr<CacheHierarchy> cacheModel;
+    if (!options.caches.empty()) {
+        cacheModel.reset(new CacheHierarchy(options.caches, cpu.decodedProgram.size()));
+        cpu.models.cache = cacheModel.get();
+    }
+    unique_ptr<BranchModel> branchModel;
+    if (!options.predictors.empty()) {
+        branchModel.reset(new BranchModel(options.predictors, cpu.decodedProgram.size(), options.mispredictPenalty));
+        cpu.models.branches = branchModel.get();
+    }
+    unique_ptr<PipelineModel> pipelineModel;
+    if (options.pipeline) {
+        pipelineModel.reset(new PipelineModel(options.forwarding));
+        cpu.models.pipeline = pipelineModel.get();
+    }
+    unique_ptr<OutOfOrderModel> outOfOrderModel;
+    if (options.outOfOrder) {
+        outOfOrderModel.reset(new OutOfOrderModel(options.outOfOrderConfig));
+        cpu.models.outOfOrder = outOfOrderModel.get();
+    }
     cout << "\nExecuting program...\n";
 
-    // Redirect output to both console and file
-    ofstream outputFile("output.txt");
-    if (outputFile.is_open()) {
-        ostringstream outputBuffer;
-        cpu.executeProgram(outputBuffer);
-
-        // Write buffer to file
-        outputFile << outputBuffer.str();
-        outputFile.close();
-
+    // Stream the trace to output.txt (and the console) through a fixed-size buffer
+    OutputSink outputSink("output.txt", options.teeToConsole ? &cout : nullptr, options.sinkBufferSize);
+    if (outputSink.isOpen()) {
+        ostream outputStream(&outputSink);
+        cpu.executeProgram(outputStream);
+        outputStream.flush();
         cout << "Output saved in output.txt" << endl;
-        cout << outputBuffer.str(); // Display buffer content to console
+        if (cpu.engine == FUSED_ENGINE) {
+            cpu.printFusionReport(cout);
+        }
+        if (cacheModel) {
+            cacheModel->report(cout, cpu.decodedProgram);
+        }
+        if (branchModel) {
+            branchModel->report(cout, cpu.decodedProgram);
+        }
+        if (pipelineModel) {
+            pipelineModel->report(cout);
+        }
+        if (outOfOrderModel) {
+            outOfOrderModel->report(cout);
+        }
+        if (cpu.memory.pageCount() > 1) {
+            cout << "Resident memory: " << cpu.memory.residentPages() << " of " << cpu.memory.pageCount() << " pages ("
+                 << cpu.memory.residentPages() * Memory::PAGE_SIZE / 1024 << " KiB)" << endl;
+        }
     } else {
         cout << "Unable to open output.txt" << endl;
     }
@@ -259,6 +1865,10 @@ int main() {
     cout << "Final Register States:\n";
     cpu.registers.display(cout);
 
+    if (!options.countersPath.empty() && !saveCounters(options.countersPath, {{engineName(cpu.lastRunEngine), cpu.counters}})) {
+        return 1;
+    }
+
     return 0;
 }
 
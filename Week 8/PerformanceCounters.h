@@ -0,0 +1,71 @@
+// Hardware-style event counters kept by the CPU. Every engine counts retired
+// instructions per type (the JIT once per block), and the other events follow from
+// those counts: every JUMP/CALL/RET in this ISA is taken. LOADs and STOREs outside
+// memory retire but reach no cell, so they are counted apart from loads and stores.
+// The counters accumulate over the CPU's lifetime, like a PMU; restoring a snapshot
+// does not rewind them.
+#ifndef VCPU_PERFORMANCE_COUNTERS_H
+#define VCPU_PERFORMANCE_COUNTERS_H
+
+#include <cstdint>
+#include <ostream>
+
+#include "Machine.h"
+
+const int INSTRUCTION_TYPES = UNKNOWN + 1;
+
+struct PerformanceCounters {
+    uint64_t retired[INSTRUCTION_TYPES] = {};  // instructions retired of each type
+    uint64_t hostNanoseconds = 0;              // host time spent running the program
+    uint64_t runs = 0;                         // calls to executeProgram
+    uint64_t loadsOutOfBounds = 0;             // LOADs from an address outside memory
+    uint64_t storesOutOfBounds = 0;            // STOREs to an address outside memory
+
+    uint64_t instructions() const {
+        uint64_t total = 0;
+        for (uint64_t count : retired) total += count;
+        return total;
+    }
+    uint64_t loads() const { return retired[LOAD] - loadsOutOfBounds; }
+    uint64_t stores() const { return retired[STORE] - storesOutOfBounds + retired[CALL]; }  // CALL stores the return address
+    uint64_t jumpsTaken() const { return retired[JUMP]; }
+    uint64_t calls() const { return retired[CALL]; }
+    uint64_t returns() const { return retired[RET]; }
+    uint64_t inputs() const { return retired[INPUT]; }
+    uint64_t outputs() const { return retired[OUTPUT]; }
+
+    void clear() { *this = PerformanceCounters(); }
+
+    // Sums the counters of several CPUs, e.g. the jobs of a batch
+    void add(const PerformanceCounters& other) {
+        for (int type = 0; type < INSTRUCTION_TYPES; ++type) retired[type] += other.retired[type];
+        hostNanoseconds += other.hostNanoseconds;
+        runs += other.runs;
+        loadsOutOfBounds += other.loadsOutOfBounds;
+        storesOutOfBounds += other.storesOutOfBounds;
+    }
+
+    // The counters as one JSON object, labelled with the engine that produced them
+    void writeJson(std::ostream& out, const char* engine) const {
+        out << "{\n  \"engine\": \"" << engine << "\",\n";
+        out << "  \"instructionsRetired\": " << instructions() << ",\n";
+        out << "  \"hostNanoseconds\": " << hostNanoseconds << ",\n";
+        out << "  \"runs\": " << runs << ",\n";
+        out << "  \"loads\": " << loads() << ",\n";
+        out << "  \"stores\": " << stores() << ",\n";
+        out << "  \"loadsOutOfBounds\": " << loadsOutOfBounds << ",\n";
+        out << "  \"storesOutOfBounds\": " << storesOutOfBounds << ",\n";
+        out << "  \"jumpsTaken\": " << jumpsTaken() << ",\n";
+        out << "  \"calls\": " << calls() << ",\n";
+        out << "  \"returns\": " << returns() << ",\n";
+        out << "  \"inputs\": " << inputs() << ",\n";
+        out << "  \"outputs\": " << outputs() << ",\n";
+        out << "  \"opcodes\": {";
+        for (int type = 0; type < INSTRUCTION_TYPES; ++type) {
+            out << (type == 0 ? "" : ", ") << '"' << opcodeName(static_cast<InstructionType>(type)) << "\": " << retired[type];
+        }
+        out << "}\n}";
+    }
+};
+
+#endif
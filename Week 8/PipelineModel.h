@@ -0,0 +1,122 @@
+// Timing model of a classic in-order 5-stage pipeline (IF ID EX MEM WB). It is fed the
+// retired instruction stream and works out the cycle in which each instruction occupies
+// each stage; the functional result still comes from the CPU.
+//
+// - One instruction enters each stage per cycle, in order.
+// - Operands are needed at the start of EX (a STORE's value at the start of MEM).
+//   With forwarding, an ALU/INPUT result can be used by the next instruction's EX, and a
+//   LOAD result one cycle later (the load-use stall). Without forwarding, values come
+//   from the register file, written in the first half of WB and read in ID.
+// - Fetch continues at the next address. JUMP/CALL resolve their target in EX and RET in
+//   MEM (it reads the return address from memory); a transfer anywhere else flushes the
+//   instructions fetched behind it and fetch restarts at the target the next cycle.
+#ifndef VCPU_PIPELINE_MODEL_H
+#define VCPU_PIPELINE_MODEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#include "Machine.h"
+
+class PipelineModel {
+public:
+    explicit PipelineModel(bool forwarding) : forwarding(forwarding) {
+        std::fill(ready, ready + REGISTER_COUNT, 0);
+        std::fill(producedByLoad, producedByLoad + REGISTER_COUNT, false);
+    }
+
+    // Times one instruction; next is the address that actually executed after it
+    void issue(int pc, const DecodedInstruction& instruction, int next) {
+        // Each time is the last cycle the instruction spends in that stage. An instruction
+        // cannot leave a stage before the one ahead of it has left the next stage.
+        InstructionType type = instruction.type;
+        uint64_t fetch = std::max({lastFetch + 1, lastDecode, redirect});
+        uint64_t decode = std::max({fetch + 1, lastDecode + 1, lastExecute});
+        uint64_t execute = std::max(decode + 1, lastExecute + 1);
+
+        // Source registers read by EX (and by MEM for a forwarded STORE value)
+        uint64_t operands = execute;
+        bool loadUse = false;
+        auto need = [&](int reg) {
+            if (ready[reg] > operands) {
+                operands = ready[reg];
+                loadUse = producedByLoad[reg];
+            }
+        };
+        if (type == ADD || type == SUB) {
+            need(instruction.reg1);
+            need(instruction.reg2);
+        } else if (type == LOAD || type == JUMP || type == CALL) {
+            need(instruction.reg2);
+        } else if (type == STORE) {
+            need(instruction.reg2);
+            if (!forwarding) need(instruction.reg1);
+        } else if (type == OUTPUT) {
+            need(instruction.reg1);
+        }
+        if (operands > execute) {
+            dataStalls += operands - execute;
+            if (loadUse) loadUseStalls += operands - execute;
+            execute = operands;
+        }
+        uint64_t memory = std::max(execute + 1, lastMemory + 1);
+        if (type == STORE && forwarding && ready[instruction.reg1] > memory) {
+            dataStalls += ready[instruction.reg1] - memory;
+            loadUseStalls += producedByLoad[instruction.reg1] ? ready[instruction.reg1] - memory : 0;
+            memory = ready[instruction.reg1];
+        }
+        uint64_t writeBack = std::max(memory + 1, lastWriteBack + 1);
+
+        // Destination register: when later instructions can use it in EX
+        if (type == ADD || type == SUB || type == LOAD || type == INPUT || type == UNKNOWN) {
+            bool fromMemory = type == LOAD;
+            ready[instruction.reg1] = forwarding ? (fromMemory ? memory : execute) + 1 : writeBack + 1;
+            producedByLoad[instruction.reg1] = fromMemory;
+        }
+
+        if (next != pc + 1) {
+            // The next instruction would have left IF with the next decode cycle
+            uint64_t resolved = type == RET ? memory : execute;
+            redirect = resolved + 1;
+            flushCycles += redirect - std::max(fetch + 1, decode);
+            ++flushes;
+        }
+        lastFetch = fetch;
+        lastDecode = decode;
+        lastExecute = execute;
+        lastMemory = memory;
+        lastWriteBack = writeBack;
+        ++instructions;
+    }
+
+    uint64_t cycles() const { return lastWriteBack; }
+
+    void report(std::ostream& out) const {
+        out << "Pipeline model (5-stage in-order, " << (forwarding ? "forwarding" : "no forwarding") << "): "
+            << instructions << " instructions in " << cycles() << " cycles, CPI " << std::fixed << std::setprecision(3)
+            << (instructions == 0 ? 0.0 : static_cast<double>(cycles()) / instructions) << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out << "  Data hazard stalls: " << dataStalls << " cycles (" << loadUseStalls << " load-use)" << std::endl;
+        out << "  Control flushes: " << flushes << " (" << flushCycles << " cycles)" << std::endl;
+    }
+
+private:
+    bool forwarding;
+    uint64_t ready[REGISTER_COUNT];           // first cycle a register's new value can enter EX
+    bool producedByLoad[REGISTER_COUNT];
+    uint64_t lastFetch = 0;                   // cycles are numbered from 1
+    uint64_t lastDecode = 0;
+    uint64_t lastExecute = 0;
+    uint64_t lastMemory = 0;
+    uint64_t lastWriteBack = 0;
+    uint64_t redirect = 0;                    // earliest fetch after the last flush
+    uint64_t instructions = 0;
+    uint64_t dataStalls = 0;
+    uint64_t loadUseStalls = 0;
+    uint64_t flushes = 0;
+    uint64_t flushCycles = 0;
+};
+
+#endif
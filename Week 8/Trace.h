@@ -0,0 +1,101 @@
+// Text trace policies. The execute loop is templated on a policy and calls its hooks
+// at each stage of an instruction; the trace decoder drives the same classes when it
+// renders a binary trace, so both produce identical text.
+#ifndef VCPU_TRACE_H
+#define VCPU_TRACE_H
+
+#include <iostream>
+
+#include "Machine.h"
+
+// Trace policies are template parameters of the execute loop. TraceOff's hooks are
+// empty, so the instantiation that uses it contains no formatting code at all.
+struct TraceOff {
+    void fetch(int, const DecodedInstruction&) {}
+    void decode(const DecodedInstruction&, Word, Word) {}
+    void input(int, int) {}
+    void output(int, int) {}
+    void jump(Word) {}
+    void call(Word) {}
+    void ret(int) {}
+    void load(int, Word) {}
+    void store(Word, Word) {}
+    void alu(const DecodedInstruction&, Word) {}
+    void memoryWrite(size_t, Word) {}
+    void retire(const Registers&, const Memory&) {}
+    void halt(int) {}
+};
+
+// One line per instruction: address, disassembly and the architectural effect
+class TraceSummary {
+public:
+    explicit TraceSummary(std::ostream& outputStream) : out(outputStream) {}
+    void fetch(int address, const DecodedInstruction& instruction) {
+        out << address << ": " << opcodeName(instruction.type) << " R" << static_cast<int>(instruction.reg1)
+            << " R" << static_cast<int>(instruction.reg2);
+    }
+    void decode(const DecodedInstruction&, Word, Word) {}
+    void input(int reg, int value) { out << " -> R" << reg << " = " << static_cast<int>(static_cast<Word>(value)); }
+    void output(int, int value) { out << " -> out " << value; }
+    void jump(Word target) { out << " -> PC = " << static_cast<int>(target); }
+    void call(Word target) { out << " -> PC = " << static_cast<int>(target); }
+    void ret(int target) { out << " -> PC = " << target; }
+    void load(int reg, Word value) { out << " -> R" << reg << " = " << static_cast<int>(value); }
+    void store(Word value, Word address) { out << " -> [" << static_cast<int>(address) << "] = " << static_cast<int>(value); }
+    void alu(const DecodedInstruction& instruction, Word result) {
+        out << " -> R" << static_cast<int>(instruction.reg1) << " = " << static_cast<int>(result);
+    }
+    void memoryWrite(size_t, Word) {}
+    void retire(const Registers&, const Memory&) { out << '\n'; }
+    void halt(int) {}
+
+private:
+    std::ostream& out;
+};
+
+// The original trace: every stage of every instruction plus the whole machine state.
+// Memory writes are also announced on the console, as the original Memory::write did.
+class TraceFull {
+public:
+    TraceFull(std::ostream& outputStream, std::ostream& consoleStream) : out(outputStream), console(consoleStream) {}
+    void fetch(int address, const DecodedInstruction& instruction) {
+        out << "Fetching instruction at address " << address << ": " << instruction.word << '\n';
+    }
+    void decode(const DecodedInstruction& instruction, Word operand1, Word operand2) {
+        out << "Decoding instruction: " << instruction.word << " as (" << opcodeName(instruction.type) << " R"
+            << static_cast<int>(instruction.reg1) << " R" << static_cast<int>(instruction.reg2) << ")" << '\n';
+        out << "Operands: " << "operand1 = " << static_cast<int>(operand1) << ", operand2 = " << static_cast<int>(operand2) << '\n';
+    }
+    void input(int reg, int value) { out << "Input value " << value << " into R" << reg << '\n'; }
+    void output(int reg, int value) { out << "Output value from R" << reg << ": " << value << '\n'; }
+    void jump(Word target) { out << "Jumping to address " << static_cast<int>(target) << '\n'; }
+    void call(Word target) { out << "Calling subroutine at address " << static_cast<int>(target) << '\n'; }
+    void ret(int target) { out << "Returning from subroutine to address " << target << '\n'; }
+    void load(int reg, Word value) { out << "Loaded value " <<static_cast<int>(value)<<"into R"<<reg<<'\n'; }
+    void store(Word value, Word address) {
+        out << "Stored value " << static_cast<int>(value) << " at memory address " << static_cast<int>(address) << '\n';
+    }
+    void alu(const DecodedInstruction& instruction, Word result) {
+        int reg1 = instruction.reg1;
+        out << "Executing instruction: " << instruction.word << " (" << opcodeName(instruction.type) << " R" << reg1
+            << " R" << static_cast<int>(instruction.reg2) << ")" << '\n';
+        out << "Updated R" << reg1 <<" to " << static_cast<int>(result) << '\n';
+    }
+    void memoryWrite(size_t address, Word value) {
+        console << "Writing value " << static_cast<int>(value) << " to memory address " << address << std::endl;
+    }
+    void retire(const Registers& registers, const Memory& memory) {
+        out << "Current Register States: ";
+        registers.display(out);
+        out << "Current Memory State: ";
+        memory.display(out);
+        out << '\n';
+    }
+    void halt(int) {}
+
+private:
+    std::ostream& out;
+    std::ostream& console;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+#include "BinaryTrace.h"
+
+using namespace std;
+
+// Renders a binary trace (--trace=binary) as the text the emulator would have printed
+template <class Trace>
+void decodeTrace(ifstream& traceFile, const BinaryTraceHeader& header, Trace& trace) {
+    Registers registers;
+    for (int i = 0; i < REGISTER_COUNT; ++i) {
+        registers.regs[i] = header.registers[i];
+    }
+    Memory memory(header.memorySize);
+    for (uint64_t i = 0; i < header.initialCellCount; ++i) {
+        BinaryTraceCell cell;
+        if (!traceFile.read(reinterpret_cast<char*>(&cell), sizeof(cell))) return;
+        memory.write(cell.address, cell.value);
+    }
+
+    vector<BinaryTraceRecord> records(TraceBinary::BUFFER_RECORDS);
+    while (traceFile) {
+        traceFile.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(BinaryTraceRecord));
+        size_t count = traceFile.gcount() / sizeof(BinaryTraceRecord);
+        for (size_t i = 0; i < count; ++i) {
+            renderBinaryTraceRecord(trace, records[i], registers, memory);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string tracePath;
+    string outputPath;
+    bool summary = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--summary") {
+            summary = true;
+        } else if (arg.rfind("--output=", 0) == 0) {
+            outputPath = arg.substr(arg.find('=') + 1);
+        } else if (tracePath.empty() && arg[0] != '-') {
+            tracePath = arg;
+        } else {
+            tracePath.clear();
+            break;
+        }
+    }
+    if (tracePath.empty()) {
+        cout << "Usage: trace-decoder <trace.bin> [--summary] [--output=FILE]" << endl;
+        return 1;
+    }
+
+    ifstream traceFile(tracePath, ios::binary);
+    if (!traceFile.is_open()) {
+        cout << "Unable to open " << tracePath << endl;
+        return 1;
+    }
+    BinaryTraceHeader header;
+    traceFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!traceFile || memcmp(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.recordSize != sizeof(BinaryTraceRecord) || header.registerCount != REGISTER_COUNT) {
+        cout << tracePath << ": not a binary trace from this emulator version" << endl;
+        return 1;
+    }
+    // The same limits as --memory-size; CALL/RET replay needs at least one cell
+    if (header.memorySize == 0 || header.memorySize > MAX_MEMORY_SIZE || header.initialCellCount > header.memorySize) {
+        cout << tracePath << ": invalid header (memory size " << header.memorySize << ", " << header.initialCellCount
+             << " initial cells)" << endl;
+        return 1;
+    }
+
+    ofstream outputFile;
+    if (!outputPath.empty()) {
+        outputFile.open(outputPath);
+        if (!outputFile.is_open()) {
+            cout << "Unable to open " << outputPath << endl;
+            return 1;
+        }
+    }
+    ostream& out = outputPath.empty() ? cout : outputFile;
+
+    if (summary) {
+        TraceSummary trace(out);
+        decodeTrace(traceFile, header, trace);
+    } else {
+        TraceFull trace(out, cout);
+        decodeTrace(traceFile, header, trace);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "DeltaTrace.h"
+
+using namespace std;
+
+// Rebuilds the full machine state at any step of a delta trace (--trace=delta)
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        cout << "Usage: trace-replay <delta trace> [step]" << endl;
+        cout << "Prints the register and memory state after <step> instructions (default: all)." << endl;
+        return 1;
+    }
+
+    ifstream traceFile(argv[1]);
+    if (!traceFile.is_open()) {
+        cout << "Unable to open " << argv[1] << endl;
+        return 1;
+    }
+    uint64_t targetStep = UINT64_MAX;
+    if (argc == 3) {
+        string text = argv[2];
+        size_t end = 0;
+        try {
+            targetStep = stoull(text, &end);
+        } catch (const exception&) {
+            end = 0;
+        }
+        if (end == 0 || end != text.size() || text[0] == '-') {
+            cout << "Invalid step: " << text << endl;
+            return 1;
+        }
+    }
+
+    DeltaTraceReader reader(traceFile);
+    if (!reader.valid()) {
+        cout << argv[1] << ": " << reader.errorMessage() << endl;
+        return 1;
+    }
+
+    Registers registers;
+    Memory memory(reader.memorySizeHeader());
+    reader.applyInitialState(registers, memory);
+
+    DeltaStep step;
+    uint64_t stepsApplied = 0;
+    int nextProgramCounter = 0;
+    bool haveNext = false;
+    while (reader.next(step)) {
+        if (stepsApplied == targetStep) {
+            nextProgramCounter = step.programCounter;
+            haveNext = true;
+            break;
+        }
+        DeltaTraceReader::apply(step, registers, memory);
+        stepsApplied++;
+    }
+    if (!reader.valid()) {
+        cout << argv[1] << ": " << reader.errorMessage() << endl;
+        return 1;
+    }
+    if (!haveNext) {
+        nextProgramCounter = reader.haltAddress();
+        if (targetStep != UINT64_MAX && stepsApplied < targetStep) {
+            cout << "Trace ends after " << stepsApplied << " steps" << endl;
+        }
+    }
+
+    cout << "State after step " << stepsApplied << " (next PC = " << nextProgramCounter << ")" << endl;
+    cout << "Current Register States: ";
+    registers.display(cout);
+    cout << "Current Memory State: ";
+    memory.display(cout);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Work-stealing pool for batches of independent jobs. Every worker owns a deque of job
+// indices: it takes work from the back of its own deque and, once that is empty,
+// steals from the front of the others'. Jobs of very different lengths then still
+// keep every core busy until the batch is done.
+#ifndef VCPU_WORK_STEALING_POOL_H
+#define VCPU_WORK_STEALING_POOL_H
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    // threads == 0 uses every hardware thread
+    explicit WorkStealingPool(unsigned threads = 0)
+        : workerCount(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+    unsigned size() const { return workerCount; }
+
+    // Runs job(index, worker) for every index in [0, count) and waits for all of them.
+    // Jobs cannot add more work, so a worker that finds nothing to steal is done.
+    template <class Job>
+    void run(size_t count, Job job) {
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        for (unsigned i = 0; i < workerCount; ++i) {
+            queues.emplace_back(new WorkQueue());
+        }
+        // Consecutive ranges, so a worker starts on jobs next to each other in the manifest
+        for (size_t index = 0; index < count; ++index) {
+            queues[index * workerCount / std::max<size_t>(count, 1)]->jobs.push_back(index);
+        }
+
+        auto work = [&](unsigned worker) {
+            size_t index;
+            while (take(*queues[worker], index) || steal(queues, worker, index)) {
+                job(index, worker);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < workerCount; ++i) {
+            threads.emplace_back(work, i);
+        }
+        work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    static bool take(WorkQueue& queue, size_t& index) {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.jobs.empty()) return false;
+        index = queue.jobs.back();
+        queue.jobs.pop_back();
+        return true;
+    }
+
+    bool steal(std::vector<std::unique_ptr<WorkQueue>>& queues, unsigned thief, size_t& index) {
+        for (unsigned offset = 1; offset < workerCount; ++offset) {
+            WorkQueue& victim = *queues[(thief + offset) % workerCount];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                index = victim.jobs.front();
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    unsigned workerCount;
+};
+
+#endif